@@ -16,13 +16,26 @@
 #include "m_brainconnectivity.h"
 
 static const char usage[] = \
-"Usage: m_brainconnectivity -i/-p <input> -o <output> <options>\n"\
+"Usage: m_brainconnectivity -i/-p/-c <input> -o <output> <options>\n"\
+"       m_brainconnectivity -b <manifest> <options>\n"\
 "\n"\
 "Required arguments:\n"\
 "-i <filename> input 4d image\n"\
 "-p <filename> alternatively, input text file where rows are time,\n"\
-"columns are nodes\n"\
+"columns are nodes. A first line without numbers is skipped as a header\n"\
+"-c <filename>[:<nodes>] alternatively, connectivity matrices that are\n"\
+"thresholded as they are, e.g. structural connectomes. A .npy file of\n"\
+"n x n or k x n x n f4 or f8 values, or a raw file of f4 (.f4) or f8 values\n"\
+"that holds one matrix, or several with the given number of nodes. Every\n"\
+"matrix is a network, and -n is not needed\n"\
 "-o <prefix> output prefix\n"\
+"-b <filename> alternatively, process many subjects in one run. Every line\n"\
+"of the file is an input (4d image if the name contains .nii, matrices if\n"\
+"it contains .npy, .f4 or .f8, text file otherwise) followed by the output\n"\
+"prefix for that input\n"\
+"-a <atlas>[:eig] reduce every 4d image to the labels of an atlas in its\n"\
+"space, where 0 is the background. Every label becomes a node, with the\n"\
+"mean time series of its voxels, or their first eigenvariate with :eig\n"\
 "\n"\
 "Options (one or more of each):\n"\
 "-n <network_definition_scheme> specify how networks are constructed.\n"\
@@ -46,41 +59,31 @@ static const char usage[] = \
 "   global:clustering_coef\n"\
 "   global:charpath\n"\
 "   global:efficiency\n"\
+"   local:clustering_coef\n"\
+"   local:efficiency the mean inverse distance of every node to the others\n"\
+"Local measures are written to <prefix>_local.npy as measure x network x\n"\
+"threshold x node, described by <prefix>_local.txt, and for 4d images as\n"\
+"maps <prefix>_local_<measure>.nii with a volume for every network and\n"\
+"threshold\n"\
+"\n"\
+"-s <length>:<step> compute a network for every window of length time\n"\
+"points, moved by step. The output has a column for every window\n"\
+"\n"\
+"-k <directory> keep the results of every network definition and threshold\n"\
+"in a cache directory. Later runs on the same input only compute what is\n"\
+"not in the cache yet. The input is kept there as well, after it is read\n"\
+"and demeaned, and later runs map it instead of reading the input again\n"\
+"-w also keep the network definition matrices in the cache directory\n"\
+"\n"\
+"-M <size> the memory that the run may use, e.g. 200G or 512M, instead of\n"\
+"the available memory. Large networks then run fewer definitions at a time,\n"\
+"and give the cores to the remaining ones\n"\
+"\n"\
+"-r <filename> record how long every stage takes in every thread, and write\n"\
+"the timeline as a chrome trace\n"\
 "\n"\
 "-d enable debug messages, however these are not very useful at present\n";
 
-static char const corr_str[] = "corr";
-static char const ridge_str[] = "ridge";
-enum networkdefinition {
-  corr = 1 << 0,
-  ridge = 1 << 1
-};
-
-static char const absolute_str[] = "absolute";
-static char const proportional_str[] = "proportional";
-static char const nnegproportional_str[] = "nnegproportional";
-enum threshold {
-  absolute = 1 << 0,
-  proportional = 1 << 1,
-  nnegproportional = 1 << 2
-};
-
-static char const global_str[] = "global";
-static char const local_str[] = "local";
-enum measuredimensionality {
-  local = 1 << 0,
-  global = 1 << 1
-};
-
-static char const charpath_str[] = "charpath";
-static char const clustering_coef_str[] = "clustering_coef";
-static char const efficiency_str[] = "efficiency";
-enum measure {
-  charpath = 1 << 2,
-  clustering_coef = 1 << 3,
-  efficiency = 1 << 4
-};
-
 static u4_t parsenetworkdefinition(char *c,
   f4_t *param) {
   char const d[] = ":";
@@ -111,16 +114,6 @@ static u4_t parsenetworkdefinition(char *c,
   return m;
 }
 
-static void networkdefinitiontostr(char *c,
-  u4_t networkdefinition, f4_t param) {
-
-  if (networkdefinition & corr) {
-    sprintf(c, "%s", corr_str);
-  } else if (networkdefinition & ridge) {
-    sprintf(c, "%s:%f", ridge_str, param);
-  }
-}
-
 static u4_t parsethreshold(char *c,
   u4_t *t, f4_t *p) {
   char const d[] = ":";
@@ -176,18 +169,79 @@ static u4_t parsethreshold(char *c,
   }
 }
 
-static void thresholdtostr(char *c,
-  u4_t threshold, f4_t param) {
+static void parsewindow(char *c,
+  u4_t *l, u4_t *s) {
+  char const d[] = ":";
 
-  if (threshold & absolute) {
-    sprintf(c, "%s:%f", absolute_str, param);
-  } else if (threshold & proportional) {
-    sprintf(c, "%s:%f", proportional_str, param);
-  } else if (threshold & nnegproportional) {
-    sprintf(c, "%s:%f", nnegproportional_str, param);
+  char b[4096];
+  strcpy(&b[0], c);
+
+  char* tok = strtok(c, d);
+  *l = tok ? (u4_t) atoi(tok) : 0;
+
+  tok = strtok(NULL, d);
+  *s = tok ? (u4_t) atoi(tok) : 0;
+
+  if (*l < 2 || *s == 0) {
+    fprintf(stderr, RED "Error: undefined window %s." WHITE "\n\n%s", b, usage);
+    exit(EXIT_FAILURE);
   }
 }
 
+static size_t parsesize(char *c) {
+  char *e;
+  f8_t v = strtod(c, &e);
+
+  f8_t u = 1.0;
+  switch (*e) {
+    case 'T': case 't':
+      u *= 1024.0;
+      // fall through
+    case 'G': case 'g':
+      u *= 1024.0;
+      // fall through
+    case 'M': case 'm':
+      u *= 1024.0;
+      // fall through
+    case 'K': case 'k':
+      u *= 1024.0;
+      e++;
+      break;
+  }
+
+  if (e == c || *e != '\0' || v <= 0.0) {
+    fprintf(stderr, RED "Error: undefined size %s." WHITE "\n\n%s", c, usage);
+    exit(EXIT_FAILURE);
+  }
+  return (size_t) (v * u);
+}
+
+// the atlas of <atlas>[:mean|:eig], eig is set for the eigenvariates
+static char *parseatlas(char *c, u4_t *eig) {
+  *eig = 0;
+
+  char *s = strrchr(c, ':');
+  if (s && strcmp(s, ":eig") == 0) {
+    *s = '\0';
+    *eig = 1;
+  } else if (s && strcmp(s, ":mean") == 0) {
+    *s = '\0';
+  }
+  return c;
+}
+
+// the matrices of <filename>[:<nodes>], nodes is set for raw files of several
+static char *parsematrices(char *c, u4_t *nodes) {
+  *nodes = 0;
+
+  char *s = strrchr(c, ':');
+  if (s && s[1] != '\0' && strspn(&s[1], "0123456789") == strlen(&s[1])) {
+    *s = '\0';
+    *nodes = (u4_t) atoi(&s[1]);
+  }
+  return c;
+}
+
 static u4_t parsemeasure(char *c) {
   char const d[] = ":";
 
@@ -209,11 +263,11 @@ static u4_t parsemeasure(char *c) {
 
   tok = strtok(NULL, d);
 
-  if (strcmp(tok, charpath_str) == 0 && (m & global)) {
+  if (tok && strcmp(tok, charpath_str) == 0 && (m & global)) {
     m |= charpath;
-  } else if (strcmp(tok, clustering_coef_str) == 0 && (m & global)) {
+  } else if (tok && strcmp(tok, clustering_coef_str) == 0) {
     m |= clustering_coef;
-  } else if (strcmp(tok, efficiency_str) == 0 && (m & global)) {
+  } else if (tok && strcmp(tok, efficiency_str) == 0) {
     m |= efficiency;
   } else {
     fprintf(stderr, RED "Error: undefined measure %s." WHITE "\n\n%s", s, usage);
@@ -223,26 +277,566 @@ static u4_t parsemeasure(char *c) {
   return m;
 }
 
-static void measuretostr(char *c,
-  u4_t m) {
+/* a subject is one input file and its output prefix. in batch mode every
+   line of the manifest is a subject, and all of them share the arenas and
+   threads of a single process
+*/
+typedef struct {
+  char *fi;
+  char *fp;
+  char *fo;
+  char *fa; // the atlas that an image is reduced with
+  char *fc; // alternatively, connectivity matrices
+  u4_t nodes; // of the matrices in a raw file, or 0
+  u4_t eig;
+  u4_t *z; // the voxel of every node of an image, or its label
+  u4_t labels;
+  input_t in; // mapped from the cache, if it was there
+} subject_t;
+
+// identifies the input of s and the atlas it is reduced with, or 0
+static u8_t subjectsource(subject_t *s) {
+  u8_t const k = sourcekey(s->fp ? s->fp : s->fi);
+  if (k == 0 || !s->fa) {
+    return k;
+  }
+
+  u8_t const a[] = {sourcekey(s->fa), s->eig};
+  if (a[0] == 0) {
+    return 0;
+  }
+  return hash_u1(k, (unsigned char*) &a[0], sizeof(a));
+}
+
+static void prepare(job_t *j) {
+  subject_t *s = (subject_t*) j->arg;
+  input_t *in = &s->in;
+
+  f8_t tr = tracebegin();
+  if (s->fc) { // the networks already, mapped in place if they are f4
+    u4_t nn[2] = {s->nodes, 0};
+    in->map = read_matrices_f4(s->fc, &nn[0], &j->x, &in->size);
+    traceend(trace_read, tr);
+
+    if (debug) {
+      printf("%u matrices of %u nodes in %s\n", nn[1], nn[0], s->fc);
+    }
+
+    j->n = nn[0];
+    j->nmatrices = nn[1];
+    j->m = nn[0]*nn[1];
+
+    s->z = NULL;
+    s->labels = 0;
+    return;
+  }
+
+  if (j->cache && readinput(j, subjectsource(s), in, 1)) {
+    traceend(trace_read, tr);
+
+    if (debug) {
+      printf("cached input of %u nodes and %u time points\n", in->n, in->m);
+    }
+
+    j->x = in->x;
+    j->n = in->n;
+    j->m = in->m;
+    j->key = in->key;
+
+    s->z = (in->nz > 0) ? in->z : NULL;
+    s->labels = in->labels;
+    return;
+  }
+
+  u4_t n;
+  u4_t m;
+
+  f4_t *x = NULL;
+  u4_t *z = NULL;
+
+  if (s->fp) {
+    u4_t nn[2];
+    read_txt_columns_f4(s->fp, &nn[0], &x);
+
+    n = nn[1]; // columns
+    m = nn[0]; // rows
+  } else if (s->fa) {
+    u4_t nn[2];
+
+    read_nii_atlas_f4(s->fi, s->fa, s->eig, &nn[0], &z, &x);
+
+    n = nn[1]; // labels
+    m = nn[0];
+  } else {
+    u4_t nn[2];
+
+    read_nii_f4(s->fi, &nn[0], &z, &x);
+
+    n = nn[1];
+    m = nn[0];
+  }
+  traceend(trace_read, tr);
+
+  fprintf(stderr, "%u %u\n", n, m);
+
+  tr = tracebegin();
+  for (u4_t i = 0; i < n; i++) {
+    f4_t q = 0.0f;
+    for (u4_t jj = 0; jj < m; jj++) {
+      q += x[i*m+jj];
+    }
+    q /= ((f4_t) m);
+    if (debug) {
+      printf("mean[%u]=%f\n", i, q);
+    }
+    for (u4_t jj = 0; jj < m; jj++) {
+      x[i*m+jj] -= q;
+    }
+  }
+  traceend(trace_demean, tr);
+
+  j->x = x;
+  j->n = n;
+  j->m = m;
+
+  s->z = z;
+  s->labels = s->fa != NULL;
+
+  if (j->cache) {
+    input_t c = {
+      .x = x,
+      .n = n,
+      .m = m,
+      .z = z,
+      .nz = z ? n : 0,
+      .labels = s->fa != NULL,
+      .key = inputkey(x, n, m)
+    };
+    if (s->fi) {
+      read_nii_dim(s->fi, &c.d[0]);
+    }
+    writeinput(j, subjectsource(s), &c);
+
+    j->key = c.key;
+  }
+}
+
+/* local measures are written to <prefix>_local.npy as measure x network x
+   threshold x node, cell by cell as they complete, and described by
+   <prefix>_local.txt. for images they are also written as maps, with a
+   volume for every network and threshold
+*/
+static void localshape(job_t *j, u4_t *d) {
+  d[0] = nlocalmeasures(j);
+  d[1] = nnetworks(j);
+  d[2] = j->nthresholds;
+  d[3] = j->n;
+}
+
+static void emit(job_t *j, f4_t *l, u4_t i, u4_t jj) {
+  subject_t *s = (subject_t*) j->arg;
+
+  u4_t d[4];
+  localshape(j, &d[0]);
+
+  char f[4096];
+  snprintf(f, sizeof(f), "%s_local.npy", s->fo);
+
+  size_t const nc = (size_t) d[1]*d[2];
+  size_t const c = (size_t) i*d[2]+jj;
+  for (u4_t k = 0; k < d[0]; k++) {
+    write_npy_block_f4(f, &d[0], 4, ((size_t) k*nc + c)*j->n, &l[(size_t) k*j->n], j->n);
+  }
+}
+
+static void finishlocal(job_t *j) {
+  subject_t *s = (subject_t*) j->arg;
+
+  u4_t d[4];
+  localshape(j, &d[0]);
+
+  char f[4096];
+  snprintf(f, sizeof(f), "%s_local.npy", s->fo);
+  write_npy_header_f4(f, &d[0], 4);
+
+  char fs[4096];
+  snprintf(fs, sizeof(fs), "%s_local.txt", s->fo);
+  FILE *fp = fopen(fs, "w");
+  if (!fp) {
+    fprintf(stderr, RED "Failed to open %s for writing." WHITE "\n", fs);
+    exit(EXIT_FAILURE);
+  }
+
+  char c[256];
+  char cw[128];
+
+  fprintf(fp, "measure");
+  for (u4_t k = 0; k < j->nmeasures; k++) {
+    if (j->measures[k] & local) {
+      measuretostr(c, j->measures[k]);
+      fprintf(fp, "\t%s", c);
+    }
+  }
+  fprintf(fp, "\nnetwork");
+  u4_t const nw = nwindows(j);
+  for (u4_t i = 0; i < d[1]; i++) {
+    networktostr(c, j, i);
+    if (j->windowlength > 0) {
+      windowtostr(cw, i % nw, j->windowlength, j->windowstep);
+      fprintf(fp, "\t%s %s", c, cw);
+    } else {
+      fprintf(fp, "\t%s", c);
+    }
+  }
+  fprintf(fp, "\nthreshold");
+  for (u4_t jj = 0; jj < d[2]; jj++) {
+    thresholdtostr(c, j->thresholds[jj], j->thresholdparams[jj]);
+    fprintf(fp, "\t%s", c);
+  }
+  fprintf(fp, "\n%s", !s->z ? "column" : s->labels ? "label" : "voxel");
+  for (u4_t q = 0; q < j->n; q++) {
+    fprintf(fp, "\t%u", s->z ? s->z[q] : q);
+  }
+  fprintf(fp, "\n");
+  fclose(fp);
+
+  if (!s->fi || !s->z || s->labels) {
+    return;
+  }
+
+  f4_t *e;
+  size_t b;
+  void *mp = map_npy_f4(f, &d[0], 4, &e, &b);
+
+  size_t const nc = (size_t) d[1]*d[2];
+  u4_t nn[] = {(u4_t) nc, j->n};
+  u4_t lk = 0;
+  for (u4_t k = 0; k < j->nmeasures; k++) {
+    if (j->measures[k] & local) {
+      measuretostr(c, j->measures[k]);
+      char *ce = strchr(c, ':');
+      snprintf(fs, sizeof(fs), "%s_local_%s.nii", s->fo, ce ? ce + 1 : c);
+      write_nii_f4(fs, s->fi, &nn[0], s->z, &e[(size_t) lk*nc*j->n]);
+      lk++;
+    }
+  }
+
+  munmap(mp, b);
+}
+
+static void finish(job_t *j) {
+  subject_t *s = (subject_t*) j->arg;
+
+  u4_t const nw = nwindows(j);
+  u4_t const nn = nnetworks(j);
+  u4_t const nthresholds = j->nthresholds;
+
+  u4_t nmeasuresglobal = 0;
+  for (u4_t i = 0; i < j->nmeasures; i++) {
+    if (j->measures[i] & global) {
+      nmeasuresglobal++;
+    }
+  }
+
+  if (debug) {
+    printmatrix(j->og, nn*nthresholds, nmeasuresglobal);
+  }
+
+  char fo[4096];
+  snprintf(fo, sizeof(fo), "%s.txt", s->fo);
+
+  f8_t tr = tracebegin();
+
+  u4_t const charsize = 128;
+  u4_t const nl = (j->windowlength > 0) ? 3 : 2;
+
+  char **cn = (char**) allocate_ptr(nn*nthresholds*nl);
+  for (u4_t i = 0; i < nn; i++) {
+    for (u4_t jj = 0; jj < nthresholds; jj++) {
+      char **c = &cn[nl*(i*nthresholds+jj)];
+      for (u4_t l = 0; l < nl; l++) {
+        c[l] = (char*) allocate_u1(charsize);
+      }
+      networktostr(c[0], j, i);
+      if (j->windowlength > 0) {
+        windowtostr(c[1], i % nw, j->windowlength, j->windowstep);
+      }
+      thresholdtostr(c[nl-1], j->thresholds[jj], j->thresholdparams[jj]);
+    }
+  }
+
+  char **rn = (char**) allocate_ptr(nmeasuresglobal);
+  u4_t kg = 0;
+  for (u4_t k = 0; k < j->nmeasures; k++) {
+    if (j->measures[k] & global) {
+      rn[kg] = (char*) allocate_u1(charsize);
+      measuretostr(rn[kg], j->measures[k]);
+      kg++;
+    }
+  }
+
+  u4_t ogn[] = {nn*nthresholds, nmeasuresglobal};
+  u4_t ognn[] = {nl, 1};
+  write_ntxt_f4(fo, &ogn[0], j->og, cn, rn, &ognn[0]);
+
+  if (nlocalmeasures(j) > 0) {
+    finishlocal(j);
+  }
+  traceend(trace_output, tr);
+
+  freeinput(&s->in);
+}
+
+static char *copystr(char *c) {
+  char *d = (char*) allocate_u1(strlen(c) + 1);
+  strcpy(d, c);
+  return d;
+}
+
+static u4_t parsemanifest(char *f,
+  subject_t **s) {
+  FILE *fp = fopen(f, "r");
+  if (!fp) {
+    fprintf(stderr, RED "Failed to open %s for reading." WHITE "\n", f);
+    exit(EXIT_FAILURE);
+  }
 
-  const char * str1 = NULL;
-  if (m & global) {
-    str1 = global_str;
-  } else if (m & local) {
-    str1 = local_str;
+  char a[8192];
+
+  u4_t l = 0;
+  while (fgets(a, sizeof(a), fp)) {
+    l++;
   }
+  rewind(fp);
+
+  *s = (subject_t*) allocate_u1(l * sizeof(subject_t));
+  memset(*s, 0, l * sizeof(subject_t));
 
-  if (m & charpath) {
-    sprintf(c, "%s:%s", str1, charpath_str);
-  } else if (m & clustering_coef) {
-    sprintf(c, "%s:%s", str1, clustering_coef_str);
-  } else if (m & efficiency) {
-    sprintf(c, "%s:%s", str1, efficiency_str);
+  u4_t k = 0;
+  while (fgets(a, sizeof(a), fp)) {
+    char *g = strtok(a, " \t\n");
+    if (!g || g[0] == '#') {
+      continue;
+    }
+    char *o = strtok(NULL, " \t\n");
+    if (!o) {
+      fprintf(stderr, RED "Error: no output prefix specified for %s." WHITE "\n\n%s", g, usage);
+      exit(EXIT_FAILURE);
+    }
+
+    (*s)[k].fi = NULL;
+    (*s)[k].fp = NULL;
+    if (strstr(g, ".nii")) {
+      (*s)[k].fi = copystr(g);
+    } else if (strstr(g, ".npy") || strstr(g, ".f4") || strstr(g, ".f8")) {
+      (*s)[k].fc = parsematrices(copystr(g), &(*s)[k].nodes);
+    } else {
+      (*s)[k].fp = copystr(g);
+    }
+    (*s)[k].fo = copystr(o);
+
+    k++;
   }
+
+  fclose(fp);
+
+  clalign_stack();
+  return k;
+}
+
+// bytes of stack that parsemanifest and the jobs of f need
+static size_t manifestsize(char *f) {
+  FILE *fp = fopen(f, "r");
+  if (!fp) {
+    fprintf(stderr, RED "Failed to open %s for reading." WHITE "\n", f);
+    exit(EXIT_FAILURE);
+  }
+
+  char a[8192];
+
+  size_t l = 0;
+  size_t b = 0;
+  while (fgets(a, sizeof(a), fp)) {
+    l++;
+    b += strlen(a) + 1;
+  }
+
+  fclose(fp);
+
+  return b + l * (sizeof(subject_t) + sizeof(job_t)) + 2*clb;
+}
+
+/* bytes of stack that one team needs for subject j, from the size of its
+   input. prepare keeps the input on the stack while the job is computed,
+   and finish the column names. h receives the heap that the job uses
+   besides its stack, and q the stack if its definitions are admitted
+*/
+static size_t subjectsize(job_t *j, size_t *h, size_t *q) {
+  subject_t *s = (subject_t*) j->arg;
+
+  size_t r; // the input after prepare
+  size_t p; // during prepare
+
+  *h = 0;
+  input_t in;
+  if (s->fc) {
+    u4_t nn[2] = {s->nodes, 0};
+    u4_t f8;
+    read_matrices_dim(s->fc, &nn[0], &f8);
+
+    j->n = nn[0];
+    j->nmatrices = nn[1];
+    j->m = nn[0]*nn[1];
+
+    r = f8 ? (size_t) j->n*j->m * sizeof(f4_t) : 0; // converted, or mapped
+    p = r;
+  } else if (j->cache && readinput(j, subjectsource(s), &in, 0)) {
+    j->n = in.n;
+    j->m = in.m;
+
+    r = 0; // mapped
+    p = 0;
+  } else if (s->fp) {
+    u4_t nn[2];
+    read_txt_dim(s->fp, &nn[0]);
+
+    j->n = nn[1];
+    j->m = nn[0];
+
+    r = (size_t) j->n*j->m * sizeof(f4_t);
+    p = r + read_txt_size(j->n);
+  } else if (s->fa) {
+    u4_t d[4];
+    read_nii_dim(s->fi, &d[0]);
+    u4_t nn[2];
+    read_nii_atlas_dim(s->fa, &nn[0]);
+
+    j->n = nn[0];
+    j->m = d[3];
+
+    r = (size_t) j->n * sizeof(u4_t) + (size_t) j->n*j->m * sizeof(f4_t); // labels
+    p = r + read_nii_atlas_size(&d[0], &nn[0], s->eig);
+  } else {
+    u4_t d[4];
+    read_nii_dim(s->fi, &d[0]);
+
+    size_t const v = (size_t) d[0]*d[1]*d[2];
+
+    j->n = (u4_t) v; // at most, voxels without signal are left out
+    j->m = d[3];
+
+    r = v * (sizeof(u4_t) + sizeof(f4_t)) + v*d[3] * sizeof(f4_t); // mask
+    p = r + read_nii_size(&d[0]);
+  }
+  r += 2*clb;
+  p += 2*clb;
+
+  *h = MAX(*h, (numanodes() - 1) * (size_t) j->n*j->m * sizeof(f4_t)); // see replicate
+
+  checkwindow(j);
+
+  size_t ng = 0;
+  for (u4_t i = 0; i < j->nmeasures; i++) {
+    if (j->measures[i] & global) {
+      ng++;
+    }
+  }
+  size_t const nl = (j->windowlength > 0) ? 3 : 2;
+  size_t const nc = (size_t) nnetworks(j) * j->nthresholds;
+  size_t const f = (nc*nl + ng) * (sizeof(char*) + 128); // see finish
+
+  *q = MAX(p, r + MAX(admittedjobsize(j), f));
+  return MAX(p, r + MAX(jobsize(j), f));
+}
+
+/* sizes the stack of every team for the largest subject before anything
+   is computed, and runs as many teams as fit into the memory, at most one
+   per thread. a is the memory of the run, or 0 for the available memory.
+   if that leaves threads idle, the stacks only hold the cells, and the
+   definitions, which only need to fit a few at a time, are admitted into
+   slots in the rest of the memory. MASSIVE_STACKSIZE overrides the size.
+   returns the number of teams and sets b to the bytes of stack per team
+*/
+static u4_t plan(job_t *j, u4_t ns, size_t shared, size_t a, size_t *b) {
+  size_t s = 0;
+  size_t q = 0;
+  size_t h = 0;
+  size_t x = 0;
+  size_t d = 0;
+  for (u4_t i = 0; i < ns; i++) {
+    size_t hi, qi;
+    s = MAX(s, subjectsize(&j[i], &hi, &qi));
+    q = MAX(q, qi);
+    h = MAX(h, hi);
+    x = MAX(x, (size_t) j[i].n*j[i].m * sizeof(f4_t));
+    d = MAX(d, definitionsize(&j[i]));
+  }
+
+  if (a == 0) {
+    a = availablememory();
+  }
+
+  #ifdef MASSIVE_MPI
+    s += (size_t) DIV_UP(ns, nranks) * sizeof(job_t) + clb; // see distribute
+    q += (size_t) DIV_UP(ns, nranks) * sizeof(job_t) + clb;
+    if (ns < (u4_t) nranks) {
+      shared += x; // the input window of the node
+    }
+    a /= (size_t) nodeprocesses;
+  #endif
+
+  size_t const mb = 1024 * 1024;
+  size_t const g = MAX(mb, hugepagesize()); // see allocate_stack
+
+  u4_t const o = stacksizeoverride();
+  size_t const t = DIV_UP((o > 0) ? (size_t) o * mb : s, g) * g;
+  size_t const ta = DIV_UP((o > 0) ? (size_t) o * mb : q, g) * g;
+
+  u4_t const all = (u4_t) omp_get_max_threads();
+
+  // teams with their definitions, or teams with the cells only and at
+  // least one slot besides them. a stack is touched in full, e.g. when it
+  // is prefaulted, so the stacks and the slots together stay within a
+  size_t k = (a > shared) ? (a - shared) / (t + h) : 0;
+  size_t ka = (a > shared + d) ? (a - shared - d) / (ta + h) : 0;
+  if (k > all) {
+    k = all;
+  }
+  if (ka > all) {
+    ka = all;
+  }
+  if (k == 0 && ka == 0) {
+    if (o == 0) {
+      fprintf(stderr, RED "Error: the job needs %zu MB of stack per team and %zu MB shared, but only %zu MB are available." WHITE "\n", DIV_UP(q + h, mb), DIV_UP(shared + d, mb), a / mb);
+      exit(EXIT_FAILURE);
+    }
+    k = 1;
+  }
+
+  if (ka <= k) {
+    if (s > t) {
+      fprintf(stderr, RED "Warning: the job needs %zu MB of stack per team, MASSIVE_STACKSIZE is %u MB." WHITE "\n", DIV_UP(s, mb), o);
+    }
+    fprintf(stderr, "Planned %zu MB of stack for each of %zu teams, %zu MB shared, %zu MB available.\n", t / mb, k, DIV_UP(shared, mb), a / mb);
+    *b = t;
+    return (u4_t) k;
+  }
+
+  size_t const r = a - shared - ka * (ta + h);
+
+  fprintf(stderr, "Planned %zu MB of stack for each of %zu teams, %zu MB shared, %zu MB available.\n", ta / mb, ka, DIV_UP(shared, mb), a / mb);
+  fprintf(stderr, "Admitting definitions of %zu MB into %zu MB, %zu at a time.\n", DIV_UP(d, mb), DIV_UP(r, mb), r / d);
+  schedulememory(r);
+
+  *b = ta;
+  return (u4_t) ka;
 }
 
 int main(int argc, char* argv[]) {
+  #ifdef MASSIVE_MPI
+    distributeinit(&argc, &argv);
+  #endif
+
   fputs(version, stdout);
 
   #pragma omp parallel
@@ -258,17 +852,22 @@ int main(int argc, char* argv[]) {
       fprintf(stderr, "Using %u threads.\n", mp);
     }
   }
-
-  #pragma omp parallel
-  {
-    allocate_stack();
-  }
-
-  fprintf(stderr, "\n");
+  fprintf(stderr, "Using %s kernels.\n", kernellevel());
 
   char *fi = NULL;
   char *fp = NULL;
   char *fo = NULL;
+  char *fb = NULL;
+  char *fk = NULL;
+  char *fr = NULL;
+  char *fa = NULL;
+  char *fc = NULL;
+  u4_t nodes = 0;
+  u4_t eig = 0;
+  u4_t cachedefinitions = 0;
+
+  u4_t windowlength = 0;
+  u4_t windowstep = 0;
 
   u4_t networkdefinitions[4096];
   f4_t networkdefinitionparams[4096];
@@ -281,9 +880,11 @@ int main(int argc, char* argv[]) {
   u4_t measures[4096];
   u4_t nmeasures = 0;
 
+  size_t mem = 0;
+
   char cc;
   u4_t nt;
-  while ((cc = getopt(argc, argv, "i:p:o:m:n:t:d")) != -1) {
+  while ((cc = getopt(argc, argv, "i:p:c:o:b:a:m:n:t:s:k:wM:r:d")) != -1) {
     switch (cc) {
       case 'i':
         fi = optarg;
@@ -291,9 +892,18 @@ int main(int argc, char* argv[]) {
       case 'p':
         fp = optarg;
         break;
+      case 'c':
+        fc = parsematrices(optarg, &nodes);
+        break;
       case 'o':
         fo = optarg;
         break;
+      case 'b':
+        fb = optarg;
+        break;
+      case 'a':
+        fa = parseatlas(optarg, &eig);
+        break;
 
       case 'm':
         measures[nmeasures++] = parsemeasure(optarg);
@@ -307,6 +917,25 @@ int main(int argc, char* argv[]) {
         nt = parsethreshold(optarg, &thresholds[nthresholds], &thresholdparams[nthresholds]);
         nthresholds += nt;
         break;
+      case 's':
+        parsewindow(optarg, &windowlength, &windowstep);
+        break;
+
+      case 'k':
+        fk = optarg;
+        break;
+      case 'w':
+        cachedefinitions = 1;
+        break;
+
+      case 'M':
+        mem = parsesize(optarg);
+        break;
+
+      case 'r':
+        fr = optarg;
+        starttrace();
+        break;
 
       case 'd':
         debug = 1;
@@ -318,58 +947,44 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  u4_t n;
-  u4_t m;
+  omp_set_dynamic(0);
+  #ifdef __INTEL_MKL__
+    mkl_set_dynamic(0);
+  #endif
 
-  f4_t *x = NULL;
-  u4_t *z = NULL;
+  // the subjects and jobs live on a stack of their own, which the teams share
 
-  if (fp) {
-    u4_t s[] = {0, 0};
-    u4_t nn[2];
-    read_txt_f4(fp, &s[0], &nn[0], &x);
+  size_t const shared = (fb ? manifestsize(fb) : sizeof(subject_t) + sizeof(job_t) + 2*clb) + clb;
+  allocate_sharedstack(shared);
 
-    n = nn[1]; // columns
-    m = nn[0]; // rows
+  subject_t *s = NULL;
+  u4_t ns = 0;
 
-    f4_t *xx = allocate_f4(n*m);
-    memcpy(xx, x, n*m * sizeof(f4_t));
-    for (u4_t i = 0; i < m; i++) { // transpose
-      for (u4_t j = 0; j < n; j++) {
-        x[j*m+i] = xx[i*n+j];
-      }
+  if (fb) {
+    ns = parsemanifest(fb, &s);
+  } else if (fp || fi || fc) {
+    if (!fo) {
+      fprintf(stderr, RED "Error: no output prefix specified." WHITE "\n\n%s", usage);
+      exit(EXIT_FAILURE);
     }
-    free_f4(n*m);
-  } else if (fi) {
-    u4_t nn[2];
 
-    read_nii_f4(fi, &nn[0], &z, &x);
-
-    n = nn[1];
-    m = nn[0];
+    s = (subject_t*) allocate_u1(sizeof(subject_t));
+    memset(s, 0, sizeof(subject_t));
+    s[0].fi = fi;
+    s[0].fp = fp;
+    s[0].fc = fc;
+    s[0].nodes = nodes;
+    s[0].fo = fo;
+    ns = 1;
   } else {
     fprintf(stderr, RED "Error: no input specified." WHITE "\n\n%s", usage);
     exit(EXIT_FAILURE);
   }
 
-  if (!fo) {
-    fprintf(stderr, RED "Error: no output prefix specified." WHITE "\n\n%s", usage);
-    exit(EXIT_FAILURE);
-  }
-
-  fprintf(stderr, "%u %u\n", n, m);
-
-  for (u4_t i = 0; i < n; i++) {
-    f4_t q = 0.0f;
-    for (u4_t j = 0; j < m; j++) {
-      q += x[i*m+j];
-    }
-    q /= ((f4_t) m);
-    if (debug) {
-      printf("mean[%u]=%f\n", i, q);
-    }
-    for (u4_t j = 0; j < m; j++) {
-      x[i*m+j] -= q;
+  for (u4_t i = 0; i < ns; i++) {
+    if (s[i].fi) { // text inputs are nodes already
+      s[i].fa = fa;
+      s[i].eig = eig;
     }
   }
 
@@ -384,158 +999,65 @@ int main(int argc, char* argv[]) {
   }
   fprintf(stderr, "%u %u %u %u\n", nnetworkdefinitions, nthresholds, nmeasuresglobal, nmeasureslocal);
 
-  f4_t *og = allocate_f4(nnetworkdefinitions*nthresholds*nmeasuresglobal);
-  for (u4_t i = 0; i < nnetworkdefinitions*nthresholds*nmeasuresglobal; i++) {
-    og[i] = 0.0f / 0.0f;
+  if (fk) {
+    if (mkdir(fk, 0755) != 0 && errno != EEXIST) {
+      fprintf(stderr, RED "Error: cannot create cache directory %s." WHITE "\n", fk);
+      exit(EXIT_FAILURE);
+    }
   }
 
-  f4_t *ol = allocate_f4(nnetworkdefinitions*nthresholds*nmeasureslocal*n);
-  for (u4_t i = 0; i < nnetworkdefinitions*nthresholds*nmeasureslocal*n; i++) {
-    ol[i] = 0.0f / 0.0f;
+  job_t *j = (job_t*) allocate_u1(ns * sizeof(job_t));
+  for (u4_t i = 0; i < ns; i++) {
+    job_t jj = {
+      .networkdefinitions = networkdefinitions,
+      .networkdefinitionparams = networkdefinitionparams,
+      .nnetworkdefinitions = nnetworkdefinitions,
+      .windowlength = windowlength,
+      .windowstep = windowstep,
+      .thresholds = thresholds,
+      .thresholdparams = thresholdparams,
+      .nthresholds = nthresholds,
+      .measures = measures,
+      .nmeasures = nmeasures,
+      .prepare = prepare,
+      .emit = emit,
+      .finish = finish,
+      .cache = fk,
+      .cachedefinitions = cachedefinitions,
+      .arg = &s[i]
+    };
+    j[i] = jj;
   }
 
-  omp_set_dynamic(0);
-  #ifdef __INTEL_MKL__
-    mkl_set_dynamic(0);
-  #endif
-
-  u4_t progress = 0;
+  size_t b;
+  u4_t const teams = plan(j, ns, shared, mem, &b);
 
-  #pragma omp parallel
+  #pragma omp parallel num_threads(teams)
   {
-    f4_t *w, *v, *ta, *tb;
-    u4_t *ti;
-
-    #pragma omp critical
-    {
-      w = allocate_f4(n*n);
-      v = allocate_f4(n*n);
-      ta = allocate_f4(nthresholds);
-      tb = allocate_f4(nthresholds);
-      ti = allocate_u4(nthresholds);
-    }
-
-    #pragma omp for schedule(static)
-    for (u4_t i = 0; i < nnetworkdefinitions; i++) {
-      if (networkdefinitions[i] & corr) {
-        cov(x, w, n, m);
-      } else if (networkdefinitions[i] & ridge) {
-        ridgecov(x, w, networkdefinitionparams[i], n, m);
-      }
-
-      cov2corr(w, n);
-
-      if (debug) {
-        printmatrix(w, n, n);
-      }
-
-      u4_t tk = 0;
-      for (u4_t j = 0; j < nthresholds; j++) {
-        if (thresholds[j] & proportional || thresholds[j] & nnegproportional) {
-          ta[tk++] = thresholdparams[j]; // extract
-        }
-      }
-      memcpy(v, w, n*n * sizeof(f4_t));
-      proportional2absolutethreshold(v, ta, n, tk); // convert
-
-      tk = 0;
-      memcpy(tb, thresholdparams, nthresholds * sizeof(f4_t)); // copy
-      for (u4_t j = 0; j < nthresholds; j++) {
-        if (thresholds[j] & proportional || thresholds[j] & nnegproportional) {
-          float pp = ta[tk++];
-          if (thresholds[j] & nnegproportional) {
-            if (pp < 0.0f) {
-              pp = 0.0f;
-            }
-          }
-
-          tb[j] = pp; // insert converted thresholds into copy
-        }
-      }
-
-      argsort(ti, tb, nthresholds);
-
-      for (u4_t j = 0; j < nthresholds; j++) {
-        u4_t jj = ti[j];
-        float t = tb[jj];
-
-        if (debug) {
-          printf("using threshold #%u = %f (%f)\n", jj, t, thresholdparams[jj]);
-        }
-
-        applyabsolutethreshold(w, t, n);
-
-        f4_t *eg = NULL, *cg = NULL, *cpg = NULL, *el = NULL, *cl = NULL;
-
-        for (u4_t k = 0; k < nmeasures; k++) {
-          if (measures[k] & global) {
-            u4_t oi = (k*nnetworkdefinitions+i)*nthresholds+jj;
-            if (debug) {
-              printf("measure at og[%u]\n", oi);
-            }
-            if (measures[k] & charpath) {
-              cpg = &og[oi];
-            } else if (measures[k] & clustering_coef) {
-              cg = &og[oi];
-            } else if (measures[k] & efficiency) {
-              eg = &og[oi];
-            }
-          } else if (measures[k] & local) {
-            float *oo = &ol[((k*nnetworkdefinitions+i)*nthresholds+jj)*n];
-            if (measures[k] & clustering_coef) {
-              cl = oo;
-            } else if (measures[k] & efficiency) {
-              el = oo;
-            }
-          }
-        }
-
-        if (eg || cpg || el) {
-          memcpy(v, w, n*n * sizeof(f4_t));
-
-          pathlength(v, eg, el, cpg, n);
-        }
-
-        if (cg || cl) {
-          memcpy(v, w, n*n * sizeof(f4_t));
-
-          triangles(v, cg, cl, n);
-        }
-
-        #pragma omp atomic
-        progress++;
-
-        showprogress(progress, nnetworkdefinitions*nthresholds);
-      }
-    }
-  }
-
-  if (debug) {
-    printmatrix(og, nnetworkdefinitions*nthresholds, nmeasuresglobal);
+    allocate_stack(b);
   }
 
-  char *foe = &fo[strlen(fo)];
-  strcpy(foe, ".txt");
+  fprintf(stderr, "\n");
 
-  u4_t const charsize = 128;
+  scheduleteams(teams);
 
-  char **cn = (char**) allocate_ptr(nnetworkdefinitions*nthresholds*2);
-  for (u4_t i = 0; i < nnetworkdefinitions; i++) {
-    for (u4_t j = 0; j < nthresholds; j++) {
-      cn[2*(i*nthresholds+j)+0] = (char*) allocate_u1(charsize);
-      cn[2*(i*nthresholds+j)+1] = (char*) allocate_u1(charsize);
-      networkdefinitiontostr(cn[2*(i*nthresholds+j)+0], networkdefinitions[i], networkdefinitionparams[i]);
-      thresholdtostr(cn[2*(i*nthresholds+j)+1], thresholds[j], thresholdparams[j]);
-    }
-  }
+  #ifdef MASSIVE_MPI
+    distribute(j, ns);
+  #else
+    schedule(j, ns);
+  #endif
 
-  char **rn = (char**) allocate_ptr(nmeasuresglobal);
-  for (u4_t i = 0; i < nmeasuresglobal; i++) {
-    rn[i] = (char*) allocate_u1(charsize);
-    measuretostr(rn[i], measures[i]);
+  if (fr) {
+    #ifdef MASSIVE_MPI
+      char c[4096];
+      snprintf(c, sizeof(c), "%s.%d", fr, rank);
+      writetrace(nranks > 1 ? c : fr, rank);
+    #else
+      writetrace(fr, 0);
+    #endif
   }
 
-  u4_t ogn[] = {nnetworkdefinitions*nthresholds, nmeasuresglobal};
-  u4_t ognn[] = {2, 1};
-  write_ntxt_f4(fo, &ogn[0], og, cn, rn, &ognn[0]);
+  #ifdef MASSIVE_MPI
+    distributefinalize();
+  #endif
 }
@@ -21,6 +21,11 @@
 #include "m_brainconnectivity_networkdefinition.h"
 #include "m_brainconnectivity_pathlength.h"
 #include "m_brainconnectivity_triangles.h"
+#include "m_brainconnectivity_schedule.h"
+#include "m_brainconnectivity_cache.h"
+#include "m_brainconnectivity_distribute.h"
+
+#include <errno.h>
 
 #ifdef _OPENMP
   #include <omp.h>
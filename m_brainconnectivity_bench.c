@@ -0,0 +1,420 @@
+// This library is part of Massive, copyright 2017 Lea Waller.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "m_brainconnectivity.h"
+
+static const char usage[] = \
+"Usage: m_brainconnectivity_bench <options>\n"\
+"\n"\
+"Times the kernels of m_brainconnectivity on synthetic data, and writes one\n"\
+"tab-separated line per kernel and thread count to stdout.\n"\
+"\n"\
+"-n <nodes> number of nodes, default 512\n"\
+"-m <time points> length of the time series, default 256\n"\
+"-g <density> proportion of edges in the random graphs, default 0.1\n"\
+"-r <samples> timed repetitions per kernel, default 5\n"\
+"-w <warmup> untimed repetitions per kernel, default 1\n"\
+"-t <threads> comma-separated list of thread counts, default all cores\n"\
+"-k <kernel> only run kernels whose name contains this string\n";
+
+/* every kernel has a setup that copies fresh input into the work buffer,
+   which is not timed, and the timed run. flops and bytes are the nominal
+   work of one run, used to report throughput
+*/
+
+typedef struct {
+  u4_t n;
+  u4_t m;
+  f4_t density;
+
+  f4_t *x; // time series, n rows of m time points
+  f4_t *c; // correlation matrix of x
+  f4_t *g; // random weighted graph
+  f4_t *p; // c, packed
+  f4_t *w; // work buffer
+  f4_t *t; // thresholds
+} bench_t;
+
+typedef struct {
+  char const *name;
+  void (*setup)(bench_t *b);
+  void (*run)(bench_t *b);
+  f8_t (*flops)(bench_t *b);
+  f8_t (*bytes)(bench_t *b);
+} kernel_t;
+
+static u8_t rngstate = 0x9e3779b97f4a7c15ULL;
+
+static f4_t uniform() {
+  return uniform_f4(&rngstate);
+}
+
+static f4_t normal() {
+  return normal_f4(&rngstate);
+}
+
+static void generate(bench_t *b) {
+  u4_t const n = b->n;
+  u4_t const m = b->m;
+
+  // a few shared signals, so that the correlations have some structure
+
+  u4_t const ns = 8;
+  f4_t *s = allocate_f4(ns*m);
+  for (u4_t i = 0; i < ns*m; i++) {
+    s[i] = normal();
+  }
+  for (u4_t i = 0; i < n; i++) {
+    u4_t k = i % ns;
+    f4_t q = 0.0f;
+    for (u4_t j = 0; j < m; j++) {
+      b->x[i*m+j] = 0.5f * s[k*m+j] + normal();
+      q += b->x[i*m+j];
+    }
+    q /= (f4_t) m;
+    for (u4_t j = 0; j < m; j++) {
+      b->x[i*m+j] -= q;
+    }
+  }
+  free_f4(ns*m);
+
+  cov(b->x, b->c, n, m);
+  cov2corr(b->c, n);
+
+  memcpy(b->p, b->c, (size_t) n*n * sizeof(f4_t));
+  packsymmetric(b->p, n);
+
+  for (u4_t i = 0; i < n; i++) {
+    b->g[i*n+i] = 0.0f;
+    for (u4_t j = 0; j < i; j++) {
+      f4_t v = (uniform() < b->density) ? uniform() : 0.0f;
+      b->g[i*n+j] = v;
+      b->g[j*n+i] = v;
+    }
+  }
+}
+
+static void copyc(bench_t *b) {
+  memcpy(b->w, b->c, (size_t) b->n*b->n * sizeof(f4_t));
+}
+
+static void copyg(bench_t *b) {
+  memcpy(b->w, b->g, (size_t) b->n*b->n * sizeof(f4_t));
+}
+
+// distances as in pathlength, where a missing edge is infinitely long
+static void copyd(bench_t *b) {
+  u4_t const n = b->n;
+  for (u4_t i = 0; i < n*n; i++) {
+    b->w[i] = (b->g[i] > 0.0f) ? 1.0f / b->g[i] : INFINITY;
+  }
+  for (u4_t i = 0; i < n; i++) {
+    b->w[i*n+i] = 0.0f;
+  }
+}
+
+static void copyt(bench_t *b) {
+  copyc(b);
+  for (u4_t i = 0; i < 4; i++) {
+    b->t[i] = 0.05f * (f4_t) (i+1);
+  }
+}
+
+// as after thresholding, where most weights are tied at zero
+static void copyz(bench_t *b) {
+  copyc(b);
+  for (size_t i = 0; i < (size_t) b->n*b->n; i++) {
+    if (fabsf(b->w[i]) < 0.3f) {
+      b->w[i] = 0.0f;
+    }
+  }
+}
+
+static void copypt(bench_t *b) {
+  copyt(b);
+  memcpy(b->w, b->p, packedsize(b->n) * sizeof(f4_t));
+}
+
+static void runcov(bench_t *b) {
+  cov(b->x, b->w, b->n, b->m);
+}
+
+static void runridgecov(bench_t *b) {
+  ridgecov(b->x, b->w, 1.0f, b->n, b->m);
+}
+
+static void runcov2corr(bench_t *b) {
+  cov2corr(b->w, b->n);
+}
+
+static void runthreshold(bench_t *b) {
+  proportional2absolutethreshold(b->w, b->t, b->n, 4);
+}
+
+static void runpackedthreshold(bench_t *b) {
+  packedproportional2absolutethreshold(b->w, b->t, b->n, 4);
+}
+
+static void rununpackthreshold(bench_t *b) {
+  unpackthreshold(b->p, b->w, 0.1f, b->n);
+}
+
+static void runpsort(bench_t *b) {
+  psort(b->w, (size_t) b->n*b->n);
+}
+
+static void runradixsort(bench_t *b) {
+  radixsort(b->w, (size_t) b->n*b->n);
+}
+
+static void runsamplesort(bench_t *b) {
+  samplesort(b->w, (size_t) b->n*b->n);
+}
+
+static void runargsort(bench_t *b) {
+  u4_t *a = allocate_u4((size_t) b->n*b->n);
+  argsort(a, b->w, b->n*b->n);
+}
+
+static void runfloydwarshall(bench_t *b) {
+  floydwarshall(b->w, b->n);
+}
+
+static void runblockfloydwarshall(bench_t *b) {
+  blockfloydwarshall(b->w, b->n);
+}
+
+static void runpathlength(bench_t *b) {
+  f4_t eg, cpg;
+  pathlength(b->w, &eg, NULL, &cpg, b->n);
+}
+
+static void runtriangles(bench_t *b) {
+  f4_t cg;
+  triangles(b->w, &cg, NULL, b->n);
+}
+
+static f8_t none(bench_t *b) {
+  (void) b;
+  return 0.0;
+}
+
+static f8_t matrixbytes(bench_t *b) {
+  return 2.0 * b->n*b->n * sizeof(f4_t); // read and write
+}
+
+static f8_t packedbytes(bench_t *b) {
+  return (f8_t) packedsize(b->n) * sizeof(f4_t) + (f8_t) b->n*b->n * sizeof(f4_t);
+}
+
+static f8_t covflops(bench_t *b) {
+  return (f8_t) b->n*b->n*b->m;
+}
+
+static f8_t ridgecovflops(bench_t *b) {
+  f8_t n = b->n;
+  return covflops(b) + 8.0 / 3.0 * n*n*n; // factorization and solve
+}
+
+static f8_t sortflops(bench_t *b) {
+  f8_t nn = (f8_t) b->n*b->n;
+  return nn * log2(nn); // comparisons
+}
+
+static f8_t packedsortflops(bench_t *b) {
+  f8_t np = (f8_t) packedsize(b->n);
+  return np * log2(np);
+}
+
+static f8_t fwflops(bench_t *b) {
+  f8_t n = b->n;
+  return 2.0 * n*n*n; // add and compare
+}
+
+static f8_t trianglesflops(bench_t *b) {
+  f8_t n = b->n;
+  return 2.0 * n*n*n;
+}
+
+static kernel_t const kernels[] = {
+  {"cov", copyc, runcov, covflops, matrixbytes},
+  {"ridgecov", copyc, runridgecov, ridgecovflops, matrixbytes},
+  {"cov2corr", copyc, runcov2corr, none, matrixbytes},
+  {"proportional2absolutethreshold", copyt, runthreshold, sortflops, matrixbytes},
+  {"packedproportional2absolutethreshold", copypt, runpackedthreshold, packedsortflops, packedbytes},
+  {"unpackthreshold", copyc, rununpackthreshold, none, packedbytes},
+  {"psort", copyc, runpsort, sortflops, matrixbytes},
+  {"radixsort", copyc, runradixsort, sortflops, matrixbytes},
+  {"radixsort_ties", copyz, runradixsort, sortflops, matrixbytes},
+  {"samplesort", copyc, runsamplesort, sortflops, matrixbytes},
+  {"samplesort_ties", copyz, runsamplesort, sortflops, matrixbytes},
+  {"argsort", copyc, runargsort, sortflops, matrixbytes},
+  {"floydwarshall", copyd, runfloydwarshall, fwflops, matrixbytes},
+  {"blockfloydwarshall", copyd, runblockfloydwarshall, fwflops, matrixbytes},
+  {"pathlength", copyg, runpathlength, fwflops, matrixbytes},
+  {"triangles", copyg, runtriangles, trianglesflops, matrixbytes}
+};
+
+static int comparef8(void const *a, void const *b) {
+  f8_t x = *(f8_t const*) a;
+  f8_t y = *(f8_t const*) b;
+  return (x > y) - (x < y);
+}
+
+static u4_t parsethreads(char *c, u4_t *t) {
+  u4_t k = 0;
+  char *s;
+  for (char *tok = strtok_r(c, ",", &s); tok && k < 64; tok = strtok_r(NULL, ",", &s)) {
+    int v = atoi(tok);
+    if (v < 1) {
+      fprintf(stderr, RED "Error: invalid thread count %s." WHITE "\n\n%s", tok, usage);
+      exit(EXIT_FAILURE);
+    }
+    t[k++] = (u4_t) v;
+  }
+  return k;
+}
+
+int main(int argc, char* argv[]) {
+  fputs(version, stderr);
+
+  bench_t b = {
+    .n = 512,
+    .m = 256,
+    .density = 0.1f
+  };
+
+  u4_t nsamples = 5;
+  u4_t nwarmup = 1;
+
+  u4_t threads[64];
+  u4_t nthreads = 0;
+
+  char *filter = NULL;
+
+  char cc;
+  while ((cc = getopt(argc, argv, "n:m:g:r:w:t:k:")) != -1) {
+    switch (cc) {
+      case 'n':
+        b.n = atoi(optarg);
+        break;
+      case 'm':
+        b.m = atoi(optarg);
+        break;
+      case 'g':
+        b.density = atof(optarg);
+        break;
+      case 'r':
+        nsamples = atoi(optarg);
+        break;
+      case 'w':
+        nwarmup = atoi(optarg);
+        break;
+      case 't':
+        nthreads = parsethreads(optarg, &threads[0]);
+        break;
+      case 'k':
+        filter = optarg;
+        break;
+      default:
+        fprintf(stderr, "%s", usage);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if (b.n < 2 || b.m < 2 || nsamples < 1) {
+    fprintf(stderr, RED "Error: invalid benchmark size." WHITE "\n\n%s", usage);
+    exit(EXIT_FAILURE);
+  }
+
+  if (nthreads == 0) {
+    threads[nthreads++] = omp_get_max_threads();
+  }
+
+  omp_set_dynamic(0);
+  #ifdef __INTEL_MKL__
+    mkl_set_dynamic(0);
+  #endif
+
+  allocate_stack(0);
+
+  size_t const nn = (size_t) b.n*b.n;
+
+  clalign_stack();
+  b.x = allocate_f4((size_t) b.n*b.m);
+  clalign_stack();
+  b.c = allocate_f4(nn);
+  clalign_stack();
+  b.g = allocate_f4(nn);
+  clalign_stack();
+  b.p = allocate_f4(nn);
+  clalign_stack();
+  b.w = allocate_f4(nn);
+  clalign_stack();
+  b.t = allocate_f4(4);
+  clalign_stack();
+
+  generate(&b);
+
+  f8_t *s = allocate_f8(nsamples);
+
+  fprintf(stderr, "Using %s kernels.\n", kernellevel());
+  printf("kernel\tn\tm\tdensity\tthreads\tsamples\tmedian_s\tmin_s\tgflops\tgbs\tspeedup\n");
+
+  for (u4_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    kernel_t const *kk = &kernels[k];
+    if (filter && !strstr(kk->name, filter)) {
+      continue;
+    }
+
+    f8_t base = 0.0;
+
+    for (u4_t p = 0; p < nthreads; p++) {
+      omp_set_num_threads(threads[p]);
+      #ifdef __INTEL_MKL__
+        mkl_set_num_threads(threads[p]);
+      #endif
+
+      for (u4_t r = 0; r < nwarmup + nsamples; r++) {
+        stackmark_t mark = mark_stack();
+
+        kk->setup(&b);
+        f8_t t0 = omp_get_wtime();
+        kk->run(&b);
+        f8_t t1 = omp_get_wtime();
+
+        release_stack(mark);
+
+        if (r >= nwarmup) {
+          s[r - nwarmup] = t1 - t0;
+        }
+      }
+
+      qsort(s, nsamples, sizeof(f8_t), comparef8);
+      f8_t median = (nsamples % 2) ? s[nsamples/2] : 0.5 * (s[nsamples/2-1] + s[nsamples/2]);
+
+      if (p == 0) {
+        base = median;
+      }
+
+      printf("%s\t%u\t%u\t%g\t%u\t%u\t%.6e\t%.6e\t%.3f\t%.3f\t%.3f\n",
+        kk->name, b.n, b.m, b.density, threads[p], nsamples, median, s[0],
+        kk->flops(&b) / median * 1e-9, kk->bytes(&b) / median * 1e-9, base / median);
+      fflush(stdout);
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
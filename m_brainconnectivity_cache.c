@@ -0,0 +1,457 @@
+// This library is part of Massive, copyright 2017 Lea Waller.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "m_brainconnectivity_cache.h"
+
+/* results are cached per cell in j->cache, in a file named after a hash of
+   the input time series, the network definition string (and window) and
+   the threshold string. a cell file holds one record per measure
+
+     "MASSIVEC" u4_t n u4_t records
+     { char name[64] u4_t l f4_t values[l] } ...
+
+   and is replaced atomically via rename, so concurrent runs can share a
+   directory. definition matrices are cached the same way as "MASSIVEP"
+   u4_t n f4_t values[n*(n-1)/2], packed as in the schedule
+
+   inputs are cached after they are read and demeaned, in a file named
+   after the path, size and modification time of the input, and of the
+   atlas it was reduced with
+
+     "MASSIVEI" u8_t key u8_t source u4_t n u4_t m u4_t nz u4_t d[4]
+     u4_t labels u4_t z[nz] f4_t x[n*m]
+
+   where key is inputkey of x, z the voxel of every node of an image, or
+   its label if labels is set, and d its dimensions. x starts at a page boundary, so that the file can be
+   mapped and x used in place
+*/
+
+static char const cellmagic[8] = {'M', 'A', 'S', 'S', 'I', 'V', 'E', 'C'};
+static char const definitionmagic[8] = {'M', 'A', 'S', 'S', 'I', 'V', 'E', 'P'};
+static char const inputmagic[8] = {'M', 'A', 'S', 'S', 'I', 'V', 'E', 'I'};
+
+static u4_t const namesize = 64;
+
+u8_t inputkey(f4_t *x,
+  u4_t n, u4_t m) {
+  u4_t s[] = {n, m};
+  u8_t h = hash_u1(0, (unsigned char*) &s[0], sizeof(s));
+  return hash_u1(h, (unsigned char*) x, (size_t) n*m * sizeof(f4_t));
+}
+
+static u8_t definitionkey(job_t *j, u4_t i) {
+  u4_t const nw = nwindows(j);
+
+  char c[128];
+  networktostr(c, j, i);
+  u8_t h = hash_u1(j->key, (unsigned char*) c, strlen(c) + 1);
+
+  if (j->windowlength > 0) {
+    windowtostr(c, i % nw, j->windowlength, j->windowstep);
+    h = hash_u1(h, (unsigned char*) c, strlen(c) + 1);
+  }
+  return h;
+}
+
+static u8_t cellkey(job_t *j, u4_t i, u4_t jj) {
+  char c[128];
+  thresholdtostr(c, j->thresholds[jj], j->thresholdparams[jj]);
+  return hash_u1(definitionkey(j, i), (unsigned char*) c, strlen(c) + 1);
+}
+
+static void cachepath(char *c, job_t *j, u8_t key, char const *e) {
+  snprintf(c, 4096, "%s/%016llx.%s", j->cache, (unsigned long long) key, e);
+}
+
+static FILE *opentemporary(char *c, char *t) {
+  snprintf(t, 4096 + 32, "%s.%d.%d", c, (int) getpid(), omp_get_thread_num());
+  FILE *fp = fopen(t, "wb");
+  if (!fp) {
+    fprintf(stderr, RED "Failed to open %s for writing." WHITE "\n", t);
+    exit(EXIT_FAILURE);
+  }
+  return fp;
+}
+
+static void committemporary(FILE *fp, char *c, char *t) {
+  if (fclose(fp) != 0 || rename(t, c) != 0) {
+    fprintf(stderr, RED "Failed to write %s." WHITE "\n", c);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// the file c if it has at most m bytes
+static unsigned char *readfile(char *c, size_t *s, size_t m) {
+  FILE *fp = fopen(c, "rb");
+  if (!fp) {
+    return NULL;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  *s = (size_t) ftell(fp);
+  rewind(fp);
+  if (*s > m) {
+    fclose(fp);
+    return NULL;
+  }
+
+  unsigned char *b = allocate_u1(*s);
+  if (fread(b, 1, *s, fp) != *s) {
+    fclose(fp);
+    free_u1(*s);
+    return NULL;
+  }
+
+  fclose(fp);
+  return b;
+}
+
+static u4_t measuresize(job_t *j, u4_t k) {
+  return (j->measures[k] & local) ? j->n : 1;
+}
+
+// a cell file has a record for every measure of the run that wrote it,
+// and keeps at most as many records of other measures from earlier runs
+static u4_t cellrecords(job_t *j) {
+  return 2 * j->nmeasures;
+}
+
+// bytes of a cell file that readcell and writecell accept
+static size_t cellfilesize(job_t *j) {
+  size_t const h = sizeof(cellmagic) + 2 * sizeof(u4_t);
+  return h + cellrecords(j) * (namesize + sizeof(u4_t) + (size_t) j->n * sizeof(f4_t));
+}
+
+// bytes of stack readcell and writecell need at most
+size_t cachesize(job_t *j) {
+  return cellfilesize(j) + (cellrecords(j) + 1) * sizeof(u4_t);
+}
+
+u4_t readcell(job_t *j, f4_t *lo, u4_t i, u4_t jj) {
+  char c[4096];
+  cachepath(c, j, cellkey(j, i, jj), "cell");
+
+  size_t s;
+  unsigned char *b = readfile(c, &s, cellfilesize(j));
+  if (!b) {
+    return 0;
+  }
+
+  u4_t found = 0;
+
+  size_t const h = sizeof(cellmagic) + 2 * sizeof(u4_t);
+  u4_t hd[2];
+  if (s >= h && memcmp(b, cellmagic, sizeof(cellmagic)) == 0) {
+    memcpy(&hd[0], &b[sizeof(cellmagic)], sizeof(hd));
+  } else {
+    hd[0] = 0;
+    hd[1] = 0;
+  }
+
+  if (hd[0] == j->n && hd[1] <= cellrecords(j)) {
+    char name[128];
+
+    // a measure that is given twice is found in the same record twice
+    for (u4_t k = 0; k < j->nmeasures; k++) {
+      measuretostr(name, j->measures[k]);
+
+      size_t o = h;
+      for (u4_t r = 0; r < hd[1] && o + namesize + sizeof(u4_t) <= s; r++) {
+        u4_t l;
+        memcpy(&l, &b[o + namesize], sizeof(u4_t));
+        size_t e = o + namesize + sizeof(u4_t) + (size_t) l * sizeof(f4_t);
+        if (e > s) {
+          break;
+        }
+
+        if (strncmp(name, (char*) &b[o], namesize) == 0 && l == measuresize(j, k)) {
+          memcpy(cellresult(j, lo, k, i, jj), &b[o + namesize + sizeof(u4_t)], l * sizeof(f4_t));
+          found++;
+          break;
+        }
+
+        o = e;
+      }
+    }
+  }
+
+  free_u1(s);
+
+  if (debug) {
+    printf("cache %s has %u of %u measures\n", c, found, j->nmeasures);
+  }
+
+  return found == j->nmeasures;
+}
+
+void writecell(job_t *j, f4_t *lo, u4_t i, u4_t jj) {
+  char c[4096];
+  char t[4096 + 32];
+  cachepath(c, j, cellkey(j, i, jj), "cell");
+
+  size_t s = 0;
+  unsigned char *b = readfile(c, &s, cellfilesize(j)); // keep measures of earlier runs
+
+  char name[128];
+
+  u4_t nr = j->nmeasures;
+
+  size_t const h = sizeof(cellmagic) + 2 * sizeof(u4_t);
+  u4_t hd[2] = {0, 0};
+  if (b && s >= h && memcmp(b, cellmagic, sizeof(cellmagic)) == 0) {
+    memcpy(&hd[0], &b[sizeof(cellmagic)], sizeof(hd));
+  }
+  if (hd[0] != j->n || hd[1] > cellrecords(j)) {
+    hd[1] = 0;
+  }
+
+  u4_t *keep = allocate_u4(hd[1] + 1);
+  size_t o = h;
+  for (u4_t r = 0; r < hd[1] && o + namesize + sizeof(u4_t) <= s; r++) {
+    u4_t l;
+    memcpy(&l, &b[o + namesize], sizeof(u4_t));
+    size_t e = o + namesize + sizeof(u4_t) + (size_t) l * sizeof(f4_t);
+    if (e > s) {
+      hd[1] = r;
+      break;
+    }
+
+    keep[r] = nr < cellrecords(j);
+    for (u4_t k = 0; k < j->nmeasures; k++) {
+      measuretostr(name, j->measures[k]);
+      if (strncmp(name, (char*) &b[o], namesize) == 0) {
+        keep[r] = 0;
+      }
+    }
+    nr += keep[r];
+
+    o = e;
+  }
+
+  FILE *fp = opentemporary(c, t);
+
+  u4_t nh[] = {j->n, nr};
+  fwrite(cellmagic, 1, sizeof(cellmagic), fp);
+  fwrite(&nh[0], sizeof(u4_t), 2, fp);
+
+  for (u4_t k = 0; k < j->nmeasures; k++) {
+    memset(name, 0, sizeof(name));
+    measuretostr(name, j->measures[k]);
+
+    u4_t l = measuresize(j, k);
+    fwrite(name, 1, namesize, fp);
+    fwrite(&l, sizeof(u4_t), 1, fp);
+    fwrite(cellresult(j, lo, k, i, jj), sizeof(f4_t), l, fp);
+  }
+
+  o = h;
+  for (u4_t r = 0; r < hd[1]; r++) {
+    u4_t l;
+    memcpy(&l, &b[o + namesize], sizeof(u4_t));
+    size_t e = o + namesize + sizeof(u4_t) + (size_t) l * sizeof(f4_t);
+    if (keep[r]) {
+      fwrite(&b[o], 1, e - o, fp);
+    }
+    o = e;
+  }
+
+  committemporary(fp, c, t);
+
+  free_u4(hd[1] + 1);
+  if (b) {
+    free_u1(s);
+  }
+}
+
+u4_t readdefinition(job_t *j, u4_t i, f4_t *w) {
+  char c[4096];
+  cachepath(c, j, definitionkey(j, i), "def");
+
+  FILE *fp = fopen(c, "rb");
+  if (!fp) {
+    return 0;
+  }
+
+  char mb[sizeof(definitionmagic)];
+  u4_t n = 0;
+
+  size_t const nn = packedsize(j->n);
+
+  u4_t r = fread(mb, 1, sizeof(mb), fp) == sizeof(mb) && \
+    memcmp(mb, definitionmagic, sizeof(mb)) == 0 && \
+    fread(&n, sizeof(u4_t), 1, fp) == 1 && n == j->n && \
+    fread(w, sizeof(f4_t), nn, fp) == nn;
+
+  fclose(fp);
+  return r;
+}
+
+void writedefinition(job_t *j, u4_t i, f4_t *w) {
+  char c[4096];
+  char t[4096 + 32];
+  cachepath(c, j, definitionkey(j, i), "def");
+
+  FILE *fp = opentemporary(c, t);
+
+  fwrite(definitionmagic, 1, sizeof(definitionmagic), fp);
+  fwrite(&j->n, sizeof(u4_t), 1, fp);
+  fwrite(w, sizeof(f4_t), packedsize(j->n), fp);
+
+  committemporary(fp, c, t);
+}
+
+typedef struct {
+  char magic[8];
+  u8_t key;
+  u8_t source;
+  u4_t n;
+  u4_t m;
+  u4_t nz;
+  u4_t d[4];
+  u4_t labels;
+  u4_t pad[4];
+} inputheader_t;
+
+static size_t const inputalign = 4096;
+
+static size_t inputoffset(u4_t nz) {
+  return DIV_UP(sizeof(inputheader_t) + (size_t) nz * sizeof(u4_t), inputalign) * inputalign;
+}
+
+/* identifies the contents of f by its path, size and modification time
+   to the nanosecond, so that a file rewritten within the same second is
+   not taken for the old one. inodes are only unique within a device
+*/
+u8_t sourcekey(char *f) {
+  struct stat st;
+  if (stat(f, &st) != 0) {
+    return 0;
+  }
+
+  char c[4096];
+  if (!realpath(f, c)) {
+    strncpy(c, f, sizeof(c) - 1);
+    c[sizeof(c) - 1] = '\0';
+  }
+
+  #ifdef __APPLE__
+    long const ns = st.st_mtimespec.tv_nsec;
+  #else
+    long const ns = st.st_mtim.tv_nsec;
+  #endif
+
+  u8_t s[] = {(u8_t) st.st_size, (u8_t) st.st_mtime, (u8_t) ns,
+    (u8_t) st.st_dev, (u8_t) st.st_ino};
+  u8_t h = hash_u1(0, (unsigned char*) c, strlen(c) + 1);
+  return hash_u1(h, (unsigned char*) &s[0], sizeof(s));
+}
+
+/* maps the cached input of source, or with map 0 only reads its shape.
+   returns 0 if there is none. the mapping is shared, read-only, so the teams and
+   processes that read the same subject share its pages
+*/
+u4_t readinput(job_t *j, u8_t source, input_t *in, u4_t map) {
+  if (source == 0) {
+    return 0;
+  }
+
+  char c[4096];
+  cachepath(c, j, source, "input");
+
+  int fd = open(c, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+
+  inputheader_t h;
+  struct stat st;
+  u4_t r = read(fd, &h, sizeof(h)) == sizeof(h) && \
+    memcmp(h.magic, inputmagic, sizeof(inputmagic)) == 0 && h.source == source && \
+    fstat(fd, &st) == 0 && \
+    (size_t) st.st_size == inputoffset(h.nz) + (size_t) h.n*h.m * sizeof(f4_t);
+
+  if (r) {
+    in->n = h.n;
+    in->m = h.m;
+    in->nz = h.nz;
+    memcpy(in->d, h.d, sizeof(h.d));
+    in->labels = h.labels;
+    in->key = h.key;
+    in->map = NULL;
+    in->size = 0;
+
+    if (map) {
+      void *b = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (b == MAP_FAILED) {
+        r = 0;
+      } else {
+        madvise(b, (size_t) st.st_size, MADV_WILLNEED);
+        in->map = b;
+        in->size = (size_t) st.st_size;
+        in->z = (u4_t*) ((unsigned char*) b + sizeof(inputheader_t));
+        in->x = (f4_t*) ((unsigned char*) b + inputoffset(h.nz));
+      }
+    }
+  }
+
+  close(fd);
+
+  if (debug) {
+    printf("input cache %s %s\n", c, r ? "found" : "not found");
+  }
+
+  return r;
+}
+
+void writeinput(job_t *j, u8_t source, input_t *in) {
+  if (source == 0) {
+    return;
+  }
+
+  char c[4096];
+  char t[4096 + 32];
+  cachepath(c, j, source, "input");
+
+  FILE *fp = opentemporary(c, t);
+
+  inputheader_t h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, inputmagic, sizeof(inputmagic));
+  h.key = in->key;
+  h.source = source;
+  h.n = in->n;
+  h.m = in->m;
+  h.nz = in->nz;
+  memcpy(h.d, in->d, sizeof(h.d));
+  h.labels = in->labels;
+
+  fwrite(&h, sizeof(h), 1, fp);
+  fwrite(in->z, sizeof(u4_t), in->nz, fp);
+
+  size_t const o = inputoffset(in->nz);
+  for (size_t k = sizeof(h) + (size_t) in->nz * sizeof(u4_t); k < o; k++) {
+    fputc(0, fp);
+  }
+  fwrite(in->x, sizeof(f4_t), (size_t) in->n*in->m, fp);
+
+  committemporary(fp, c, t);
+}
+
+void freeinput(input_t *in) {
+  if (in->map) {
+    munmap(in->map, in->size);
+    in->map = NULL;
+  }
+}
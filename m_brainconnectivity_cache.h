@@ -0,0 +1,56 @@
+// This library is part of Massive, copyright 2017 Lea Waller.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __M_BRAINCONNECTIVITY_CACHE_H__
+#define __M_BRAINCONNECTIVITY_CACHE_H__
+
+#include "m_common.h"
+
+#include "m_brainconnectivity_schedule.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+u8_t inputkey(f4_t *x, u4_t n, u4_t m);
+
+// an input as it was prepared, n nodes by m time points
+typedef struct {
+  f4_t *x;
+  u4_t n;
+  u4_t m;
+  u4_t *z; // the voxel of every node of an image, nz of them
+  u4_t nz;
+  u4_t d[4]; // dimensions of the image
+  u4_t labels; // z is the atlas label of every node instead
+  u8_t key; // inputkey of x
+  void *map;
+  size_t size;
+} input_t;
+
+size_t cachesize(job_t *j);
+
+u4_t readcell(job_t *j, f4_t *lo, u4_t i, u4_t jj);
+void writecell(job_t *j, f4_t *lo, u4_t i, u4_t jj);
+
+u4_t readdefinition(job_t *j, u4_t i, f4_t *w);
+void writedefinition(job_t *j, u4_t i, f4_t *w);
+
+u8_t sourcekey(char *f);
+u4_t readinput(job_t *j, u8_t source, input_t *in, u4_t map);
+void writeinput(job_t *j, u8_t source, input_t *in);
+void freeinput(input_t *in);
+
+#endif
@@ -0,0 +1,227 @@
+// This library is part of Massive, copyright 2017 Lea Waller.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "m_brainconnectivity_distribute.h"
+
+#ifdef MASSIVE_MPI
+
+/* jobs are spread over the processes in one of three ways
+
+   - with at least as many jobs as processes, every process runs its own
+     jobs and writes their output
+   - otherwise, the job's input is read once and broadcast into a window
+     that the processes of a node share. with at least as many cells as
+     processes, the cells are split into blocks and the results are summed
+     on the first process, which writes the output
+   - with fewer cells than processes all processes work on every cell,
+     and the tiles of blockfloydwarshall are distributed instead
+
+   the intended layout is one process per NUMA domain, with OpenMP threads
+   for the cores of that domain
+*/
+
+int rank;
+int nranks;
+int nodeprocesses;
+
+static MPI_Comm nodecomm;
+static MPI_Comm leadercomm;
+static int noderank;
+
+static void (*finishlocal)(job_t *j);
+
+void distributeinit(int *argc, char ***argv) {
+  int provided;
+  MPI_Init_thread(argc, argv, MPI_THREAD_SERIALIZED, &provided);
+  if (provided < MPI_THREAD_SERIALIZED) {
+    fprintf(stderr, RED "Error: MPI does not support MPI_THREAD_SERIALIZED." WHITE "\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &nranks);
+
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodecomm);
+  MPI_Comm_rank(nodecomm, &noderank);
+  MPI_Comm_size(nodecomm, &nodeprocesses);
+
+  MPI_Comm_split(MPI_COMM_WORLD, noderank == 0 ? 0 : MPI_UNDEFINED, rank, &leadercomm);
+
+  fprintf(stderr, "Process %d of %d on node %d.\n", rank, nranks, threadnode());
+}
+
+void distributefinalize() {
+  if (leadercomm != MPI_COMM_NULL) {
+    MPI_Comm_free(&leadercomm);
+  }
+  MPI_Comm_free(&nodecomm);
+  MPI_Finalize();
+}
+
+static MPI_Win shareinput(job_t *j) {
+  u4_t s[2];
+
+  if (rank == 0) {
+    if (j->prepare) {
+      j->prepare(j);
+    }
+    s[0] = j->n;
+    s[1] = j->m;
+  }
+
+  MPI_Bcast(&s[0], 2, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+
+  size_t const nm = (size_t) s[0] * s[1];
+
+  MPI_Aint b = (noderank == 0) ? (MPI_Aint) (nm * sizeof(f4_t)) : 0;
+
+  f4_t *x;
+  MPI_Win w;
+  MPI_Win_allocate_shared(b, sizeof(f4_t), MPI_INFO_NULL, nodecomm, &x, &w);
+  if (noderank != 0) {
+    int du;
+    MPI_Win_shared_query(w, 0, &b, &du, &x);
+  }
+
+  if (rank == 0) {
+    memcpy(x, j->x, nm * sizeof(f4_t));
+  }
+  if (noderank == 0) {
+    for (size_t o = 0; o < nm; o += INT32_MAX) { // counts are int
+      size_t c = (nm - o < INT32_MAX) ? nm - o : INT32_MAX;
+      MPI_Bcast(&x[o], (int) c, MPI_FLOAT, 0, leadercomm);
+    }
+  }
+
+  MPI_Barrier(nodecomm);
+
+  j->x = x;
+  j->n = s[0];
+  j->m = s[1];
+  j->prepare = NULL;
+
+  return w;
+}
+
+static void reduce(f4_t *a, size_t n) {
+  for (size_t o = 0; o < n; o += INT32_MAX) {
+    size_t c = (n - o < INT32_MAX) ? n - o : INT32_MAX;
+    if (rank == 0) {
+      MPI_Reduce(MPI_IN_PLACE, &a[o], (int) c, MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
+    } else {
+      MPI_Reduce(&a[o], NULL, (int) c, MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
+    }
+  }
+}
+
+static void reducefinish(job_t *j) {
+  // every cell is computed on exactly one process, the others hold zeros.
+  // the local measures were emitted by the process of their cell
+
+  for (u4_t k = 0; k < j->nmeasures; k++) {
+    if (!(j->measures[k] & global)) {
+      continue;
+    }
+    for (u4_t i = 0; i < nnetworks(j); i++) {
+      for (u4_t jj = 0; jj < j->nthresholds; jj++) {
+        u4_t c = i*j->nthresholds+jj;
+        if (c < j->cellbegin || c >= j->cellend) {
+          *cellresult(j, NULL, k, i, jj) = 0.0f;
+        }
+      }
+    }
+  }
+
+  u4_t nmeasuresglobal = 0;
+  for (u4_t k = 0; k < j->nmeasures; k++) {
+    if (j->measures[k] & global) {
+      nmeasuresglobal++;
+    }
+  }
+
+  size_t const nc = (size_t) nnetworks(j) * j->nthresholds;
+
+  reduce(j->og, nc*nmeasuresglobal);
+
+  if (rank == 0 && finishlocal) {
+    finishlocal(j);
+  }
+}
+
+static void cellsjob(job_t *j) {
+  u4_t const nc = nnetworks(j) * j->nthresholds;
+
+  j->cellbegin = (u4_t) (((u8_t) nc * rank) / nranks);
+  j->cellend = (u4_t) (((u8_t) nc * (rank + 1)) / nranks);
+
+  finishlocal = j->finish;
+  j->finish = reducefinish;
+
+  schedule(j, 1);
+}
+
+static void cooperativejob(job_t *j) {
+  // all processes have to reach the floyd-warshall rounds in the same order
+
+  j->cache = NULL;
+  if (rank != 0) {
+    j->emit = NULL;
+    j->finish = NULL;
+  }
+
+  MPI_Comm_dup(MPI_COMM_WORLD, &fwcomm);
+  u4_t t = scheduleteams(1);
+
+  schedule(j, 1);
+
+  scheduleteams(t);
+  MPI_Comm_free(&fwcomm);
+  fwcomm = MPI_COMM_NULL;
+}
+
+void distribute(job_t *j, u4_t nj) {
+  if (nj >= (u4_t) nranks) {
+    stackmark_t mark = mark_stack();
+
+    job_t *jr = (job_t*) allocate_u1(DIV_UP(nj, nranks) * sizeof(job_t));
+
+    u4_t k = 0;
+    for (u4_t i = rank; i < nj; i += nranks) {
+      jr[k++] = j[i];
+    }
+
+    schedule(jr, k);
+
+    release_stack(mark);
+  } else {
+    for (u4_t i = 0; i < nj; i++) {
+      stackmark_t mark = mark_stack();
+
+      MPI_Win w = shareinput(&j[i]);
+
+      if (nnetworks(&j[i]) * j[i].nthresholds >= (u4_t) nranks) {
+        cellsjob(&j[i]);
+      } else {
+        cooperativejob(&j[i]);
+      }
+
+      MPI_Win_free(&w);
+
+      release_stack(mark);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,36 @@
+// This library is part of Massive, copyright 2017 Lea Waller.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __M_BRAINCONNECTIVITY_DISTRIBUTE_H__
+#define __M_BRAINCONNECTIVITY_DISTRIBUTE_H__
+
+#include "m_common.h"
+
+#include "m_brainconnectivity_schedule.h"
+
+#ifdef MASSIVE_MPI
+  #include <mpi.h>
+
+  extern int rank;
+  extern int nranks;
+  extern int nodeprocesses; // processes that share the memory of this node
+
+  void distributeinit(int *argc, char ***argv);
+  void distributefinalize();
+
+  void distribute(job_t *j, u4_t nj);
+#endif
+
+#endif
@@ -46,7 +46,7 @@ void cov(f4_t * restrict x, f4_t * restrict c,
   }
 }
 
-void ridgecov(f4_t * restrict x, f4_t * restrict c,
+u4_t ridgecov(f4_t * restrict x, f4_t * restrict c,
   f4_t rho,
   u4_t n, u4_t m) {
 
@@ -71,6 +71,15 @@ void ridgecov(f4_t * restrict x, f4_t * restrict c,
         c,
         &nn);
 
+  return cov2precision(c, rho, n);
+}
+
+u4_t cov2precision(f4_t * restrict c,
+  f4_t rho,
+  u4_t n) {
+
+  integer nn = n;
+
   f4_t ms = 0.0f;
   for (u4_t i = 0; i < n; i++) {
     ms += c[i*n+i] * c[i*n+i];
@@ -94,6 +103,7 @@ void ridgecov(f4_t * restrict x, f4_t * restrict c,
   integer info;
 
   double * restrict b = allocate_f8(n*n);
+  memset(b, 0, n*n * sizeof(double)); // the stack may be reused
   for (u4_t i = 0; i < n; i++) {
     b[i*n+i] = 1.0f;
   }
@@ -110,22 +120,75 @@ void ridgecov(f4_t * restrict x, f4_t * restrict c,
         &nn,
         &info);
 
-  if (info != 0) {
-    exit(EXIT_FAILURE);
-  }
-
-  for (u4_t i = 0; i < n; i++) {
-    for (u4_t j = 0; j < n; j++) {
-      c[i*n+j] = -1.0f * (f4_t) b[i*n+j];
+  if (info == 0) {
+    for (u4_t i = 0; i < n; i++) {
+      for (u4_t j = 0; j < n; j++) {
+        c[i*n+j] = -1.0f * (f4_t) b[i*n+j];
+      }
     }
   }
 
   free_u8(n);
   free_f8(n*n);
   free_f8(n*n);
+
+  return (u4_t) info;
 }
 
-void cov2corr(f4_t * restrict c,
+/* for sliding windows, s and u hold the sums of products and of values over
+   the time points of the current window, and are moved along the time axis
+   by adding and removing a few time points at a time
+*/
+void windowsums(f4_t * restrict x, f4_t * restrict s, f4_t * restrict u,
+  u4_t t, u4_t l, f4_t alpha,
+  u4_t n, u4_t m) {
+
+  char uplo = 'l';
+  char ttrans = 't';
+
+  integer nn = n;
+  integer ll = l;
+  integer mm = m;
+
+  f4_t beta = 1.0f;
+
+  FORTRAN_WRAPPER(ssyrk)(
+        &uplo, // s += alpha * x[:, t:t+l] * x[:, t:t+l]'
+        &ttrans,
+        &nn,
+        &ll,
+        &alpha,
+        &x[t],
+        &mm,
+        &beta,
+        s,
+        &nn);
+
+  for (u4_t i = 0; i < n; i++) {
+    f4_t q = 0.0f;
+    for (u4_t k = t; k < t + l; k++) {
+      q += x[i*m+k];
+    }
+    u[i] += alpha * q;
+  }
+}
+
+DISPATCH void sums2cov(f4_t * restrict s, f4_t * restrict u, f4_t * restrict c,
+  u4_t n, u4_t l) {
+
+  f4_t const a = 1.0f / ((f4_t) (l - 1));
+  f4_t const b = 1.0f / ((f4_t) l);
+
+  for (u4_t i = 0; i < n; i++) {
+    for (u4_t j = 0; j <= i; j++) {
+      f4_t cc = (s[j*n+i] - u[i] * u[j] * b) * a;
+      c[j*n+i] = cc;
+      c[i*n+j] = cc;
+    }
+  }
+}
+
+DISPATCH void cov2corr(f4_t * restrict c,
   u4_t n) {
   for (u4_t i = 0; i < n; i++) {
     if (fabsf(c[i*n+i]) > FLT_EPSILON) {
@@ -148,7 +211,7 @@ void cov2corr(f4_t * restrict c,
   }
 }
 
-void corr2z(f4_t * restrict c,
+DISPATCH void corr2z(f4_t * restrict c,
   u4_t n) {
   for (u4_t i = 0; i < n; i++) {
     for (u4_t j = 0; j < n; j++) {
@@ -157,22 +220,111 @@ void corr2z(f4_t * restrict c,
   }
 }
 
+// the rank in the n*n ascending weights that keeps a proportion p of them
+static size_t proportionrank(f4_t p, u4_t n) {
+  size_t const nn = (size_t) n*n;
+  size_t const k = (p > 0.0f) ? (size_t) (p * (f4_t) nn) : 0;
+  if (k >= nn) {
+    return 0;
+  }
+  return (k > 0) ? nn - k : nn - 1; // a proportion of zero keeps the strongest weight only
+}
+
 void proportional2absolutethreshold(f4_t * restrict c, f4_t * restrict t,
   u4_t n, u4_t m) {
 
-  pquicksort(c, n*n);
+  psort(c, (size_t) n*n);
+
+  for (u4_t i = 0; i < m; i++) {
+    t[i] = c[proportionrank(t[i], n)];
+  }
+}
+
+/* definitions are symmetric with a zero diagonal, so only the strict
+   upper triangle is kept, row by row. the thresholds read it directly, and
+   each threshold expands it into a full matrix for the measures
+*/
+
+size_t packedsize(u4_t n) {
+  return (size_t) n*(n-1) / 2;
+}
+
+// the packed index of row i, column i+1
+static inline size_t packedrow(u4_t i, u4_t n) {
+  return (size_t) i*n - (size_t) i*(i+1) / 2;
+}
+
+// in place, the rows only move towards the front
+void packsymmetric(f4_t *c,
+  u4_t n) {
+  for (u4_t i = 0; i < n; i++) {
+    memmove(&c[packedrow(i, n)], &c[(size_t) i*n+i+1], (n-i-1) * sizeof(f4_t));
+  }
+}
+
+/* the same thresholds as proportional2absolutethreshold on the full matrix,
+   where every weight appears twice and the diagonal adds n zeros after the
+   negative weights
+*/
+void packedproportional2absolutethreshold(f4_t * restrict p, f4_t * restrict t,
+  u4_t n, u4_t m) {
+  size_t const np = packedsize(n);
+
+  psort(p, np);
+
+  size_t z = 0;
+  while (z < np && p[z] < 0.0f) {
+    z++;
+  }
 
   for (u4_t i = 0; i < m; i++) {
-    u4_t k = (u4_t) (t[i] * (f4_t) (n*n));
-    int q = ((int) n*n) - (int) k;
-    if (q < 0) {
-      q = 0;
+    size_t const r = proportionrank(t[i], n);
+    if (r < 2*z) {
+      t[i] = p[r / 2];
+    } else if (r < 2*z + n) {
+      t[i] = 0.0f;
+    } else {
+      t[i] = p[(r - n) / 2];
+    }
+  }
+}
+
+// applyabsolutethreshold while expanding p into c, in tiles so that the
+// lower triangle is written close to the upper one
+DISPATCH void unpackthreshold(f4_t * restrict p, f4_t * restrict c, f4_t t,
+  u4_t n) {
+  u4_t const b = 64;
+  u4_t const nb = DIV_UP(n, b);
+
+  #pragma omp parallel for schedule(dynamic)
+  for (u4_t k = 0; k < nb*nb; k++) {
+    u4_t const ib = k / nb;
+    u4_t const jb = k % nb;
+    if (jb < ib) {
+      continue;
+    }
+
+    u4_t const i1 = ((ib+1)*b < n) ? (ib+1)*b : n;
+    u4_t const j1 = ((jb+1)*b < n) ? (jb+1)*b : n;
+
+    for (u4_t i = ib*b; i < i1; i++) {
+      size_t const o = packedrow(i, n);
+      if (ib == jb) {
+        c[(size_t) i*n+i] = 0.0f;
+      }
+      for (u4_t j = MAX(jb*b, i+1); j < j1; j++) {
+        f4_t x = p[o + j-i-1];
+        if (x < t) {
+          x = 0.0f;
+        }
+        c[(size_t) i*n+j] = x;
+        c[(size_t) j*n+i] = x;
+      }
     }
-    t[i] = c[q];
   }
 }
 
-void applyabsolutethreshold(f4_t * restrict c, f4_t t,
+DISPATCH void applyabsolutethreshold(f4_t * restrict c, f4_t t,
   u4_t n) {
   #pragma omp parallel for simd
   for (u4_t i = 0; i < n*n; i++) {
@@ -23,7 +23,14 @@
 #endif
 
 void cov(f4_t * restrict x, f4_t * restrict c, u4_t n, u4_t m);
-void ridgecov(f4_t * restrict x, f4_t * restrict c, f4_t rho, u4_t n, u4_t m);
+// these return the info of dgesv, which is 0 on success
+u4_t ridgecov(f4_t * restrict x, f4_t * restrict c, f4_t rho, u4_t n, u4_t m);
+u4_t cov2precision(f4_t * restrict c, f4_t rho, u4_t n);
+
+void windowsums(f4_t * restrict x, f4_t * restrict s, f4_t * restrict u,
+  u4_t t, u4_t l, f4_t alpha, u4_t n, u4_t m);
+void sums2cov(f4_t * restrict s, f4_t * restrict u, f4_t * restrict c,
+  u4_t n, u4_t l);
 
 void cov2corr(f4_t * restrict c, u4_t n);
 void corr2z(f4_t * restrict c, u4_t n);
@@ -34,4 +41,11 @@ void proportional2absolutethreshold(f4_t * restrict c, f4_t * restrict t,
 void applyabsolutethreshold(f4_t * restrict c, f4_t t,
   u4_t n);
 
+size_t packedsize(u4_t n);
+void packsymmetric(f4_t *c, u4_t n);
+void packedproportional2absolutethreshold(f4_t * restrict p, f4_t * restrict t,
+  u4_t n, u4_t m);
+void unpackthreshold(f4_t * restrict p, f4_t * restrict c, f4_t t,
+  u4_t n);
+
 #endif
@@ -17,7 +17,7 @@
 
 static u4_t const block_size = 128;
 
-void floydwarshall(af4_ptr restrict c, u4_t n) {
+DISPATCH void floydwarshall(af4_ptr restrict c, u4_t n) {
   for (u4_t k = 0; k < n; k++) {
     #pragma omp parallel for
     for (u4_t i = 0; i < n; i++) {
@@ -93,6 +93,98 @@ static inline void sub4(af4_ptr restrict a,
   }
 }
 
+DISPATCH static void taskfloydwarshall(af4_ptr restrict d,
+  u4_t m) {
+  #pragma omp parallel shared(d)
+  #pragma omp single nowait
+  for (u4_t k = 0; k < m; k++) {
+    #pragma omp task depend(inout:d[(k*m+k)*block_size*block_size])
+    sub1(&d[(k*m+k)*block_size*block_size]);
+
+    for (u4_t i = 0; i < m; i++) {
+      if (i != k) {
+        #pragma omp task depend(in:d[(k*m+k)*block_size*block_size]) depend(inout:d[(k*m+i)*block_size*block_size])
+        sub2(&d[(k*m+k)*block_size*block_size], &d[(k*m+i)*block_size*block_size]);
+        #pragma omp task depend(in:d[(k*m+k)*block_size*block_size]) depend(inout:d[(i*m+k)*block_size*block_size])
+        sub3(&d[(k*m+k)*block_size*block_size], &d[(i*m+k)*block_size*block_size]);
+      }
+    }
+
+    for (u4_t i = 0; i < m; i++) {
+      for (u4_t j = 0; j < m; j++) {
+        if (i != k && j != k) {
+          #pragma omp task depend(inout:d[(i*m+k)*block_size*block_size],d[(k*m+j)*block_size*block_size],d[(i*m+j)*block_size*block_size])
+          sub4(&d[(i*m+k)*block_size*block_size], &d[(k*m+j)*block_size*block_size], &d[(i*m+j)*block_size*block_size]);
+        }
+      }
+    }
+  }
+}
+
+#ifdef MASSIVE_MPI
+MPI_Comm fwcomm = MPI_COMM_NULL;
+
+/* the tile rows are distributed cyclically over the processes in fwcomm.
+   in every round the owner of tile row k updates it and broadcasts it,
+   then each process updates the tiles of its own rows. every process
+   holds the full matrix, and gets the final rows of the others at the end
+*/
+DISPATCH static void distributedfloydwarshall(af4_ptr restrict d,
+  u4_t m) {
+  int r;
+  int s;
+  MPI_Comm_rank(fwcomm, &r);
+  MPI_Comm_size(fwcomm, &s);
+
+  size_t const bb = block_size*block_size;
+
+  for (u4_t k = 0; k < m; k++) {
+    f8_t tr = tracebegin();
+    int o = k % s;
+
+    if (o == r) {
+      sub1(&d[(k*m+k)*bb]);
+
+      #pragma omp parallel for schedule(dynamic)
+      for (u4_t i = 0; i < m; i++) {
+        if (i != k) {
+          sub2(&d[(k*m+k)*bb], &d[(k*m+i)*bb]);
+        }
+      }
+    }
+
+    MPI_Bcast(&d[k*m*bb], m*bb, MPI_FLOAT, o, fwcomm);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (u4_t i = r; i < m; i += s) {
+      if (i != k) {
+        sub3(&d[(k*m+k)*bb], &d[(i*m+k)*bb]);
+      }
+    }
+
+    #pragma omp parallel for collapse(2) schedule(dynamic)
+    for (u4_t i = r; i < m; i += s) {
+      for (u4_t j = 0; j < m; j++) {
+        if (i != k && j != k) {
+          sub4(&d[(i*m+k)*bb], &d[(k*m+j)*bb], &d[(i*m+j)*bb]);
+        }
+      }
+    }
+    traceend(trace_floydwarshall, tr);
+  }
+
+  for (u4_t i = 0; i < m; i++) {
+    MPI_Bcast(&d[i*m*bb], m*bb, MPI_FLOAT, i % s, fwcomm);
+  }
+}
+#endif
+
+// bytes of stack that blockfloydwarshall needs, including alignment
+size_t blockfloydwarshallsize(u4_t n) {
+  size_t const p = (size_t) DIV_UP(n, block_size)*block_size;
+  return p*p * sizeof(f4_t) + clb;
+}
+
 void blockfloydwarshall(f4_t * restrict c,
   u4_t n) {
 
@@ -119,32 +211,21 @@ void blockfloydwarshall(f4_t * restrict c,
     }
   }
 
-  // compute
-
-  #pragma omp parallel shared(d)
-  #pragma omp single nowait
-  for (u4_t k = 0; k < m; k++) {
-    #pragma omp task depend(inout:d[(k*m+k)*block_size*block_size])
-    sub1(&d[(k*m+k)*block_size*block_size]);
+  // compute, traced per round where the rounds do not overlap
 
-    for (u4_t i = 0; i < m; i++) {
-      if (i != k) {
-        #pragma omp task depend(in:d[(k*m+k)*block_size*block_size]) depend(inout:d[(k*m+i)*block_size*block_size])
-        sub2(&d[(k*m+k)*block_size*block_size], &d[(k*m+i)*block_size*block_size]);
-        #pragma omp task depend(in:d[(k*m+k)*block_size*block_size]) depend(inout:d[(i*m+k)*block_size*block_size])
-        sub3(&d[(k*m+k)*block_size*block_size], &d[(i*m+k)*block_size*block_size]);
-      }
-    }
-
-    for (u4_t i = 0; i < m; i++) {
-      for (u4_t j = 0; j < m; j++) {
-        if (i != k && j != k) {
-          #pragma omp task depend(inout:d[(i*m+k)*block_size*block_size],d[(k*m+j)*block_size*block_size],d[(i*m+j)*block_size*block_size])
-          sub4(&d[(i*m+k)*block_size*block_size], &d[(k*m+j)*block_size*block_size], &d[(i*m+j)*block_size*block_size]);
-        }
-      }
-    }
+  #ifdef MASSIVE_MPI
+  if (fwcomm != MPI_COMM_NULL) {
+    distributedfloydwarshall(d, m);
+  } else {
+    f8_t tr = tracebegin();
+    taskfloydwarshall(d, m);
+    traceend(trace_floydwarshall, tr);
   }
+  #else
+    f8_t tr = tracebegin();
+    taskfloydwarshall(d, m);
+    traceend(trace_floydwarshall, tr);
+  #endif
 
   // unpack
 
@@ -163,7 +244,7 @@ void blockfloydwarshall(f4_t * restrict c,
   free_f4(p*p);
 }
 
-void pathlength(f4_t * restrict c, // input matrix
+DISPATCH void pathlength(f4_t * restrict c, // input matrix
   f4_t * restrict eg, f4_t * restrict el, f4_t * restrict cpg,
   u4_t n) {
 
@@ -192,18 +273,13 @@ void pathlength(f4_t * restrict c, // input matrix
     printmatrix(c, n, n);
   }
 
-  // if (el) {
-  //   for (u4_t i = 0; i < n; i++) {
-  //     el[i] = 0.0f;
-  //   }
-  // }
-
   u4_t k = 0;
   float es = 0.0f;
   float cps = 0.0f;
 
-  #pragma omp parallel for reduction(+:es,cps)
+  #pragma omp parallel for reduction(+:es,cps,k)
   for (u4_t i = 0; i < n; i++) {
+    f4_t ei = 0.0f;
     for (u4_t j = 0; j < n; j++) {
       if (!isinf(c[i*n+j])) {
         cps += c[i*n+j];
@@ -211,12 +287,11 @@ void pathlength(f4_t * restrict c, // input matrix
       }
       if (i != j && fabsf(c[i*n+j]) > FLT_EPSILON) {
         es += 1.0f / c[i*n+j];
+        ei += 1.0f / c[i*n+j];
       }
-      // if (el) {
-      //   if (i != j && fabsf(c[i*n+j]) > FLT_EPSILON) {
-      //     el[i] += (1.0f / c[i*n+j]) * ;
-      //   }
-      // }
+    }
+    if (el) { // the nodal efficiency of i
+      el[i] = ei / (f4_t) (n - 1);
     }
   }
 
@@ -234,10 +309,4 @@ void pathlength(f4_t * restrict c, // input matrix
   if (cpg) {
     *cpg = cps;
   }
-
-  // if (el) {
-  //   for (u4_t i = 0; i < n; i++) {
-  //     el[i] /= (f4_t) (n * (n - 1));
-  //   }
-  // }
 }
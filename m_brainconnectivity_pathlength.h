@@ -22,8 +22,15 @@
   #include <omp.h>
 #endif
 
+#ifdef MASSIVE_MPI
+  #include <mpi.h>
+
+  extern MPI_Comm fwcomm; // distribute blockfloydwarshall over these processes
+#endif
+
 void floydwarshall(af4_ptr restrict c, u4_t n);
 void blockfloydwarshall(f4_t * restrict c, u4_t n);
+size_t blockfloydwarshallsize(u4_t n);
 
 void pathlength(f4_t * restrict c, // input matrix
   f4_t * restrict eg, f4_t * restrict el, f4_t * restrict cpg,
@@ -0,0 +1,1082 @@
+// This library is part of Massive, copyright 2017 Lea Waller.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "m_brainconnectivity_schedule.h"
+#include "m_brainconnectivity_cache.h"
+
+char const corr_str[] = "corr";
+char const ridge_str[] = "ridge";
+
+char const absolute_str[] = "absolute";
+char const proportional_str[] = "proportional";
+char const nnegproportional_str[] = "nnegproportional";
+
+char const window_str[] = "window";
+char const matrix_str[] = "matrix";
+
+char const global_str[] = "global";
+char const local_str[] = "local";
+
+char const charpath_str[] = "charpath";
+char const clustering_coef_str[] = "clustering_coef";
+char const efficiency_str[] = "efficiency";
+
+void networkdefinitiontostr(char *c,
+  u4_t networkdefinition, f4_t param) {
+
+  if (networkdefinition & corr) {
+    sprintf(c, "%s", corr_str);
+  } else if (networkdefinition & ridge) {
+    sprintf(c, "%s:%f", ridge_str, param);
+  }
+}
+
+void thresholdtostr(char *c,
+  u4_t threshold, f4_t param) {
+
+  if (threshold & absolute) {
+    sprintf(c, "%s:%f", absolute_str, param);
+  } else if (threshold & proportional) {
+    sprintf(c, "%s:%f", proportional_str, param);
+  } else if (threshold & nnegproportional) {
+    sprintf(c, "%s:%f", nnegproportional_str, param);
+  }
+}
+
+void windowtostr(char *c,
+  u4_t k, u4_t windowlength, u4_t windowstep) {
+
+  sprintf(c, "%s:%u:%u", window_str, k * windowstep, windowlength);
+}
+
+void measuretostr(char *c,
+  u4_t m) {
+
+  const char * str1 = NULL;
+  if (m & global) {
+    str1 = global_str;
+  } else if (m & local) {
+    str1 = local_str;
+  }
+
+  if (m & charpath) {
+    sprintf(c, "%s:%s", str1, charpath_str);
+  } else if (m & clustering_coef) {
+    sprintf(c, "%s:%s", str1, clustering_coef_str);
+  } else if (m & efficiency) {
+    sprintf(c, "%s:%s", str1, efficiency_str);
+  }
+}
+
+/* the job is split into the graph
+
+     gram/definition -> threshold conversion -> threshold -> measure
+
+   where every node is an OpenMP task, so idle threads steal cells from
+   whichever definition still has work left instead of waiting for more
+   definitions. a task may open a nested team for its kernel, and the size
+   of that team follows the kernel's flop count and the cores that are not
+   already busy. expensive kernels are also started first via task priority.
+   several jobs, e.g. subjects, can share one schedule and thus one team
+*/
+
+static f8_t const grain = 16777216.0; // flops below which one thread suffices
+
+static u4_t teams;
+static u4_t nodes;
+static u4_t cores;
+static u4_t busy;
+static u4_t progress;
+static u4_t shown;
+static u4_t ncells;
+
+static f8_t definitioncost(job_t *j, u4_t i) {
+  f8_t n = (f8_t) j->n;
+  f8_t m = (f8_t) j->m;
+
+  if (j->nmatrices > 0) {
+    return n * n; // packing
+  }
+
+  f8_t c = (j->windowlength > 0) ? n * n : n * n * m; // ssyrk
+  if (j->networkdefinitions[i] & ridge) {
+    c += 3.0 * n * n * n; // dgesv
+  }
+  return c;
+}
+
+// reading the input, with n and m as planned, if they are known
+static f8_t preparecost(job_t *j) {
+  return 64.0 * (f8_t) j->n * (f8_t) j->m;
+}
+
+static f8_t windowcost(job_t *j, u4_t first) {
+  f8_t n = (f8_t) j->n;
+  f8_t l = (f8_t) (first ? j->windowlength : 2 * j->windowstep);
+  return n * n * l;
+}
+
+static f8_t conversioncost(job_t *j) {
+  f8_t q = (f8_t) packedsize(j->n);
+  return q * log2(q + 1.0);
+}
+
+static f8_t thresholdcost(job_t *j) {
+  return (f8_t) j->n * (f8_t) j->n;
+}
+
+static f8_t measurecost(job_t *j) {
+  f8_t n = (f8_t) j->n;
+  return n * n * n; // floyd-warshall or ssymm
+}
+
+static int priority(f8_t c) {
+  return (int) log2(c / grain + 1.0);
+}
+
+static u4_t acquire(f8_t c) {
+  f8_t w = c / grain;
+  if (w > (f8_t) cores) {
+    w = (f8_t) cores;
+  }
+
+  u4_t k;
+  #pragma omp critical(schedule)
+  {
+    u4_t f = (busy < cores) ? cores - busy : 0;
+    k = (u4_t) w;
+    if (k > f) {
+      k = f;
+    }
+    if (k < 1) {
+      k = 1;
+    }
+    busy += k;
+  }
+
+  omp_set_num_threads(k);
+  return k;
+}
+
+static void release(u4_t k) {
+  #pragma omp atomic
+  busy -= k;
+}
+
+/* with several NUMA nodes, every node gets its own copy of the input, so
+   that the definitions read it locally. definition matrices that are large
+   enough to matter are interleaved over the nodes, because the thresholds
+   of every team read them. the tasks count where the matrices they copy
+   come from
+*/
+
+static size_t const interleavesize = 16 * 1024 * 1024; // bytes, at least
+
+static u8_t readlocal;
+static u8_t readremote;
+static u8_t readinterleaved;
+
+static void replicate(job_t *j) {
+  j->xr = NULL;
+  if (nodes < 2) {
+    return;
+  }
+
+  size_t const b = (size_t) j->n*j->m * sizeof(f4_t);
+  int const h = addressnode(j->x);
+
+  j->xr = (f4_t**) allocate_ptr(nodes);
+  for (u4_t k = 0; k < nodes; k++) {
+    if ((int) k == h) {
+      j->xr[k] = j->x;
+    } else {
+      j->xr[k] = (f4_t*) allocate_onnode(b, k);
+      memcpy(j->xr[k], j->x, b);
+    }
+  }
+}
+
+static void unreplicate(job_t *j) {
+  if (!j->xr) {
+    return;
+  }
+
+  size_t const b = (size_t) j->n*j->m * sizeof(f4_t);
+  for (u4_t k = 0; k < nodes; k++) {
+    if (j->xr[k] != j->x) {
+      free_numa(j->xr[k], b);
+    }
+  }
+  j->xr = NULL; // the pointers are released with the job's stack
+}
+
+// the copy of x on the node of this thread
+static f4_t *localx(job_t *j) {
+  if (j->xr) {
+    int const k = threadnode();
+    if (k >= 0 && (u4_t) k < nodes) {
+      return j->xr[k];
+    }
+  }
+  return j->x;
+}
+
+static u4_t interleaved(job_t *j) {
+  return nodes > 1 && packedsize(j->n) * sizeof(f4_t) >= interleavesize;
+}
+
+/* c is a full matrix on top of the stack, whose packed definition is at
+   the front. the rest of c is given back, and the definition moved to the
+   nodes if it is interleaved
+*/
+static f4_t *keepdefinition(job_t *j, f4_t *c) {
+  size_t const nn = (size_t) j->n*j->n;
+  size_t const np = packedsize(j->n);
+  if (interleaved(j)) {
+    f4_t *w = (f4_t*) allocate_interleaved(np * sizeof(f4_t));
+    memcpy(w, c, np * sizeof(f4_t));
+    free_f4(nn);
+    return w;
+  }
+  free_f4(nn - np);
+  return c;
+}
+
+static f4_t *allocate_definition(job_t *j) {
+  size_t const np = packedsize(j->n);
+  if (interleaved(j)) {
+    return (f4_t*) allocate_interleaved(np * sizeof(f4_t));
+  }
+  return allocate_f4(np);
+}
+
+// a definition in the slot s is given back with the slot, see dismiss
+static void free_definition(job_t *j, f4_t *w, unsigned char *s) {
+  if (interleaved(j)) {
+    free_numa(w, packedsize(j->n) * sizeof(f4_t));
+  } else if (!s) {
+    free_f4(packedsize(j->n));
+  }
+}
+
+// b bytes at p are read by this thread, i is set if they are interleaved
+static void countread(void *p, size_t b, u4_t i) {
+  if (nodes < 2) {
+    return;
+  }
+  if (i) {
+    #pragma omp atomic
+    readinterleaved += b;
+  } else if (addressnode(p) == threadnode()) {
+    #pragma omp atomic
+    readlocal += b;
+  } else {
+    #pragma omp atomic
+    readremote += b;
+  }
+}
+
+u4_t nwindows(job_t *j) {
+  if (j->windowlength == 0) {
+    return 1;
+  }
+  return (j->m - j->windowlength) / j->windowstep + 1;
+}
+
+u4_t nnetworks(job_t *j) {
+  if (j->nmatrices > 0) {
+    return j->nmatrices;
+  }
+  return j->nnetworkdefinitions * nwindows(j);
+}
+
+// the definition of network i, without its window
+void networktostr(char *c, job_t *j, u4_t i) {
+  if (j->nmatrices > 0) {
+    sprintf(c, "%s:%u", matrix_str, i);
+  } else {
+    u4_t const ii = i / nwindows(j);
+    networkdefinitiontostr(c, j->networkdefinitions[ii], j->networkdefinitionparams[ii]);
+  }
+}
+
+u4_t nlocalmeasures(job_t *j) {
+  u4_t nl = 0;
+  for (u4_t k = 0; k < j->nmeasures; k++) {
+    if (j->measures[k] & local) {
+      nl++;
+    }
+  }
+  return nl;
+}
+
+// where measure k of cell i, jj goes. global measures go to og, and local
+// measures to l, the local measures of the cell one after the other
+f4_t *cellresult(job_t *j, f4_t *l, u4_t k, u4_t i, u4_t jj) {
+  u4_t const mk = j->measures[k] & (global | local);
+
+  u4_t kk = 0; // among the measures of the same kind
+  for (u4_t q = 0; q < k; q++) {
+    if (j->measures[q] & mk) {
+      kk++;
+    }
+  }
+
+  if (mk & global) {
+    u4_t const oi = (kk*nnetworks(j)+i)*j->nthresholds+jj;
+    if (debug) {
+      printf("measure at og[%u]\n", oi);
+    }
+    return &j->og[oi];
+  } else {
+    return &l[(size_t) kk*j->n];
+  }
+}
+
+void checkwindow(job_t *j) {
+  if (j->windowlength > 0 && j->nmatrices > 0) {
+    fprintf(stderr, RED "Error: windows need time series, not connectivity matrices." WHITE "\n");
+    exit(EXIT_FAILURE);
+  }
+  if (j->windowlength > 0) {
+    if (j->windowlength < 2 || j->windowlength > j->m || j->windowstep == 0) {
+      fprintf(stderr, RED "Error: invalid window %u:%u for %u time points." WHITE "\n", j->windowlength, j->windowstep, j->m);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/* bytes of stack that one thread needs at most to compute j once n and m
+   are known, besides what prepare and finish allocate. a thread that waits
+   for tasks only runs their descendants, so its stack holds at most one
+   chain of job, definition, thresholds and measure at a time
+*/
+/* a team needs the definition part only while it computes a definition,
+   the cells part whenever it runs thresholds, and transient while the
+   definition is computed, where cells is not in use yet
+*/
+static void jobparts(job_t *j, size_t *definition, size_t *transient, size_t *cells) {
+  size_t const n = j->n;
+  size_t const nn = n*n * sizeof(f4_t);
+  size_t const np = packedsize(j->n) * sizeof(f4_t);
+  size_t const nt = j->nthresholds * sizeof(u4_t);
+
+  size_t const c = j->cache ? cachesize(j) : 0;
+
+  size_t const l = (size_t) nlocalmeasures(j) * n * sizeof(f4_t);
+
+  size_t const measure = nn + MAX(blockfloydwarshallsize(j->n), nn);
+  size_t const threshold = l + nn + MAX(measure, c);
+  *cells = 2 * nt + MAX(np + sortsize(packedsize(j->n)), threshold);
+
+  *definition = nt + np;
+  if (j->windowlength > 0) {
+    *definition += nn + n * sizeof(f4_t); // sums
+  }
+
+  *transient = c;
+  if (j->nmatrices > 0) {
+    return; // packed straight from x
+  }
+  for (u4_t i = 0; i < j->nnetworkdefinitions; i++) {
+    if (j->networkdefinitions[i] & ridge) {
+      *transient = MAX(*transient, 2*n*n * sizeof(f8_t) + n * sizeof(u8_t));
+    }
+  }
+  *transient += nn - np; // the full matrix before it is packed
+}
+
+size_t jobsize(job_t *j) {
+  size_t ng = 0;
+  for (u4_t k = 0; k < j->nmeasures; k++) {
+    if (j->measures[k] & global) {
+      ng++;
+    }
+  }
+  size_t const nc = (size_t) nnetworks(j) * j->nthresholds;
+
+  size_t definition, transient, cells;
+  jobparts(j, &definition, &transient, &cells);
+
+  return nc * ng * sizeof(f4_t) + definition + \
+    MAX(transient, cells) + 4*clb;
+}
+
+// jobsize when the definitions of j are computed in slots, see admit
+size_t admittedjobsize(job_t *j) {
+  size_t ng = 0;
+  for (u4_t k = 0; k < j->nmeasures; k++) {
+    if (j->measures[k] & global) {
+      ng++;
+    }
+  }
+  size_t const nc = (size_t) nnetworks(j) * j->nthresholds;
+
+  size_t definition, transient, cells;
+  jobparts(j, &definition, &transient, &cells);
+
+  size_t const nt = j->nthresholds * sizeof(u4_t); // see pending
+  return nc * ng * sizeof(f4_t) + nt + cells + 4*clb;
+}
+
+// the bytes of a slot that one definition of j takes
+size_t definitionsize(job_t *j) {
+  size_t definition, transient, cells;
+  jobparts(j, &definition, &transient, &cells);
+
+  return DIV_UP(definition + transient, clb) * clb + 2*clb;
+}
+
+/* definitions are admitted against a budget of memory, so that large
+   networks run fewer definitions at a time than there are teams. the
+   budget is a region of slots, one per definition, so the stacks of the
+   teams only hold the cells. the other teams run the cells of the
+   admitted definitions, and the kernels get the cores that are left over.
+   there is at least one slot, so every job makes progress
+*/
+
+static size_t budget; // bytes, or 0 for no limit
+static unsigned char *region;
+static size_t slotsize;
+static u4_t nslots;
+static unsigned char **freeslots;
+static u4_t nfree;
+
+static unsigned char *tryadmit() {
+  unsigned char *s = NULL;
+  #pragma omp critical(memory)
+  {
+    if (nfree > 0) {
+      s = freeslots[--nfree];
+    }
+  }
+  return s;
+}
+
+/* the thread that generates the definitions of a job must not wait while
+   definitions that it queued are not running, since other teams may be
+   waiting in admit as well. so it first runs or waits for its own queued
+   definitions, and only waits for the others if there are none. taskyield
+   cannot be relied on for this, libgomp ignores it. queued counts the
+   definitions that the job has generated since its last taskwait.
+   returns the slot of the definition, or NULL without a budget
+*/
+static unsigned char *admit(job_t *j, u4_t *queued) {
+  if (budget == 0) {
+    return NULL;
+  }
+  if (definitionsize(j) > slotsize) {
+    fprintf(stderr, RED "Error: a definition needs %zu MB, but the slots were planned for %zu MB." WHITE "\n", DIV_UP(definitionsize(j), 1024 * 1024), DIV_UP(slotsize, 1024 * 1024));
+    exit(EXIT_FAILURE);
+  }
+  unsigned char *s;
+  while (!(s = tryadmit())) {
+    if (*queued > 0) {
+      #pragma omp taskwait
+      *queued = 0;
+    } else {
+      usleep(100);
+    }
+  }
+  (*queued)++;
+  return s;
+}
+
+static void dismiss(unsigned char *s) {
+  if (!s) {
+    return;
+  }
+  #pragma omp critical(memory)
+  freeslots[nfree++] = s;
+}
+
+// moves the stack of this thread to the slot s from byte o on, if there
+// is a slot. leaveslot moves it back, and the slot keeps what is on it
+static stackmark_t enterslot(unsigned char *s, size_t o) {
+  stackmark_t m = mark_stack();
+  if (s) {
+    attach_stack(s + o, slotsize - o);
+  }
+  return m;
+}
+
+static void leaveslot(unsigned char *s, stackmark_t m) {
+  if (s) {
+    release_stack(m);
+  }
+}
+
+// k more cells are done. the display only moves forward, even if threads
+// get to print in another order than they counted
+static void advance(u4_t k) {
+  u4_t p;
+  #pragma omp atomic capture
+  p = progress += k;
+
+  #pragma omp critical(progress)
+  if (p > shown) {
+    shown = p;
+    showprogress(p - 1, ncells);
+  }
+}
+
+// whether j has measures of pathlength if l is 0, or of triangles if l is 1
+static u4_t needskernel(job_t *j, u4_t l) {
+  for (u4_t k = 0; k < j->nmeasures; k++) {
+    u4_t const mk = j->measures[k];
+    if ((l == 0 && (mk & (charpath | efficiency))) || (l == 1 && (mk & clustering_coef))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// the kernels overwrite v, which is the task's own
+static void measuretask(job_t *j, f4_t *v, f4_t *lo, u4_t i, u4_t jj, u4_t l) {
+  u4_t const n = j->n;
+
+  f4_t *eg = NULL, *cg = NULL, *cpg = NULL, *el = NULL, *cl = NULL;
+
+  for (u4_t k = 0; k < j->nmeasures; k++) {
+    u4_t const mk = j->measures[k];
+    if ((mk & (charpath | efficiency)) && l != 0) {
+      continue;
+    }
+    if ((mk & clustering_coef) && l != 1) {
+      continue;
+    }
+    f4_t *oo = cellresult(j, lo, k, i, jj);
+    if (mk & global) {
+      if (mk & charpath) {
+        cpg = oo;
+      } else if (mk & clustering_coef) {
+        cg = oo;
+      } else if (mk & efficiency) {
+        eg = oo;
+      }
+    } else if (mk & local) {
+      if (mk & clustering_coef) {
+        cl = oo;
+      } else if (mk & efficiency) {
+        el = oo;
+      }
+    }
+  }
+
+  if (!(eg || cpg || el || cg || cl)) {
+    return;
+  }
+
+  u4_t t = acquire(measurecost(j));
+  if (l == 0) {
+    pathlength(v, eg, el, cpg, n);
+  } else {
+    if (cl) {
+      memset(cl, 0, n * sizeof(f4_t)); // nodes without triangles
+    }
+    f8_t tr = tracebegin();
+    triangles(v, cg, cl, n);
+    traceend(trace_triangles, tr);
+  }
+  release(t);
+}
+
+static void thresholdtask(job_t *j, f4_t *w, u4_t i, u4_t jj, f4_t th) {
+  u4_t const n = j->n;
+
+  if (debug) {
+    printf("using threshold #%u = %f (%f)\n", jj, th, j->thresholdparams[jj]);
+  }
+
+  size_t const nl = (size_t) nlocalmeasures(j) * n;
+  f4_t *lo = allocate_f4(nl);
+  for (size_t k = 0; k < nl; k++) {
+    lo[k] = NAN;
+  }
+
+  f4_t *v = allocate_f4((size_t) n*n);
+  countread(w, packedsize(n) * sizeof(f4_t), interleaved(j));
+
+  u4_t t = acquire(thresholdcost(j));
+  f8_t tr = tracebegin();
+  unpackthreshold(w, v, th, n);
+  traceend(trace_threshold, tr);
+  release(t);
+
+  // pathlength and triangles both overwrite the matrix, so pathlength
+  // gets a copy only if triangles needs v as well
+  u4_t const pk = needskernel(j, 0);
+  u4_t const tk = needskernel(j, 1);
+  f4_t *u = v;
+  if (pk && tk) {
+    u = allocate_f4((size_t) n*n);
+    memcpy(u, v, (size_t) n*n * sizeof(f4_t));
+  }
+
+  int const p = priority(measurecost(j));
+  if (pk) {
+    #pragma omp task priority(p)
+    measuretask(j, u, lo, i, jj, 0);
+  }
+  if (tk) {
+    #pragma omp task priority(p)
+    measuretask(j, v, lo, i, jj, 1);
+  }
+  #pragma omp taskwait
+
+  if (pk && tk) {
+    free_f4((size_t) n*n);
+  }
+
+  if (j->cache) {
+    writecell(j, lo, i, jj);
+  }
+  if (j->emit && nl > 0) {
+    j->emit(j, lo, i, jj);
+  }
+
+  free_f4((size_t) n*n);
+  free_f4(nl);
+
+  advance(1);
+}
+
+// marks the cells of network i that are cached or computed elsewhere, and
+// returns how many are left
+static u4_t pending(job_t *j, u4_t i, u4_t *cached) {
+  u4_t const nthresholds = j->nthresholds;
+
+  size_t const nl = (size_t) nlocalmeasures(j) * j->n;
+  f4_t *lo = allocate_f4(nl);
+
+  u4_t nc = 0;
+  u4_t no = 0;
+  for (u4_t jj = 0; jj < nthresholds; jj++) {
+    u4_t c = i*nthresholds+jj;
+    if (j->cellend > 0 && (c < j->cellbegin || c >= j->cellend)) {
+      cached[jj] = 1; // another process computes this cell
+      no++;
+      continue;
+    }
+    cached[jj] = j->cache ? readcell(j, lo, i, jj) : 0;
+    nc += cached[jj];
+    if (cached[jj] && j->emit && nl > 0) {
+      j->emit(j, lo, i, jj);
+    }
+  }
+
+  free_f4(nl);
+
+  if (nc > 0) {
+    advance(nc);
+  }
+
+  return nthresholds - nc - no;
+}
+
+static void thresholdcells(job_t *j, u4_t i, f4_t *w, u4_t *cached) {
+  u4_t const n = j->n;
+  u4_t const nthresholds = j->nthresholds;
+
+  if (debug) {
+    printmatrix(w, 1, packedsize(n));
+  }
+
+  f4_t *ta = allocate_f4(nthresholds);
+  f4_t *tb = allocate_f4(nthresholds);
+
+  u4_t tk = 0;
+  for (u4_t jj = 0; jj < nthresholds; jj++) {
+    if (j->thresholds[jj] & proportional || j->thresholds[jj] & nnegproportional) {
+      ta[tk++] = j->thresholdparams[jj]; // extract
+    }
+  }
+  if (tk > 0) {
+    size_t const np = packedsize(n);
+    f4_t *v = allocate_f4(np);
+    memcpy(v, w, np * sizeof(f4_t));
+    countread(w, np * sizeof(f4_t), interleaved(j));
+
+    u4_t t = acquire(conversioncost(j));
+    f8_t tr = tracebegin();
+    packedproportional2absolutethreshold(v, ta, n, tk); // convert
+    traceend(trace_threshold, tr);
+    release(t);
+
+    free_f4(np);
+  }
+
+  tk = 0;
+  memcpy(tb, j->thresholdparams, nthresholds * sizeof(f4_t)); // copy
+  for (u4_t jj = 0; jj < nthresholds; jj++) {
+    if (j->thresholds[jj] & proportional || j->thresholds[jj] & nnegproportional) {
+      f4_t pp = ta[tk++];
+      if (j->thresholds[jj] & nnegproportional) {
+        if (pp < 0.0f) {
+          pp = 0.0f;
+        }
+      }
+
+      tb[jj] = pp; // insert converted thresholds into copy
+    }
+  }
+
+  // thresholds are applied to a copy of w each, so the cells are independent
+
+  for (u4_t jj = 0; jj < nthresholds; jj++) {
+    if (cached[jj]) {
+      continue;
+    }
+    f4_t th = tb[jj];
+    #pragma omp task firstprivate(jj, th)
+    thresholdtask(j, w, i, jj, th);
+  }
+  #pragma omp taskwait
+
+  free_f4(nthresholds);
+  free_f4(nthresholds);
+}
+
+static void singular(u4_t info) {
+  if (info != 0) {
+    fprintf(stderr, RED "Error: ridge regression failed, dgesv returned %u." WHITE "\n", info);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void definitiontask(job_t *j, u4_t i, unsigned char *slot) {
+  u4_t const n = j->n;
+  u4_t const nthresholds = j->nthresholds;
+
+  u4_t *cached = allocate_u4(nthresholds);
+
+  if (pending(j, i, cached) > 0) {
+    stackmark_t m = enterslot(slot, 0);
+
+    f4_t *c = allocate_f4((size_t) n*n);
+
+    if (!(j->cache && j->cachedefinitions && readdefinition(j, i, c))) {
+      f4_t *x = localx(j);
+      countread(x, (size_t) n*j->m * sizeof(f4_t), 0);
+
+      u4_t t = acquire(definitioncost(j, i));
+      f8_t tr = tracebegin();
+      if (j->networkdefinitions[i] & corr) {
+        cov(x, c, n, j->m);
+      } else if (j->networkdefinitions[i] & ridge) {
+        singular(ridgecov(x, c, j->networkdefinitionparams[i], n, j->m));
+      }
+
+      cov2corr(c, n);
+      packsymmetric(c, n);
+      traceend(trace_covariance, tr);
+      release(t);
+
+      if (j->cache && j->cachedefinitions) {
+        writedefinition(j, i, c);
+      }
+    }
+
+    f4_t *w = keepdefinition(j, c);
+    leaveslot(slot, m);
+
+    thresholdcells(j, i, w, cached);
+
+    free_definition(j, w, slot);
+  }
+
+  free_u4(nthresholds);
+
+  dismiss(slot);
+}
+
+/* connectivity matrix i of the input, whose upper triangle is packed
+   straight into a definition. the diagonal is ignored, as for the others
+*/
+static void matrixtask(job_t *j, u4_t i, unsigned char *slot) {
+  u4_t const n = j->n;
+  u4_t const nthresholds = j->nthresholds;
+
+  u4_t *cached = allocate_u4(nthresholds);
+
+  if (pending(j, i, cached) > 0) {
+    f4_t const *x = &localx(j)[(size_t) i*n*n];
+    countread((void*) x, (size_t) n*n * sizeof(f4_t), 0);
+
+    stackmark_t m = enterslot(slot, 0);
+    f4_t *w = allocate_definition(j);
+    leaveslot(slot, m);
+
+    f8_t tr = tracebegin();
+    size_t o = 0;
+    for (u4_t k = 0; k < n; k++) {
+      memcpy(&w[o], &x[(size_t) k*n+k+1], (n-k-1) * sizeof(f4_t));
+      o += n-k-1;
+    }
+    traceend(trace_covariance, tr);
+
+    thresholdcells(j, i, w, cached);
+
+    free_definition(j, w, slot);
+  }
+
+  free_u4(nthresholds);
+
+  dismiss(slot);
+}
+
+/* windows w0 to w1 of network definition i. the first window is computed
+   in full, the others by moving the sums along by windowstep time points,
+   which costs O(n^2 windowstep) instead of O(n^2 windowlength). windows
+   are split into runs of at most windowlength/windowstep, so rounding
+   errors cannot accumulate
+*/
+static void windowtask(job_t *j, u4_t i, u4_t w0, u4_t w1, unsigned char *slot) {
+  u4_t const n = j->n;
+  u4_t const nthresholds = j->nthresholds;
+  u4_t const nw = nwindows(j);
+  u4_t const l = j->windowlength;
+  u4_t const p = j->windowstep;
+
+  u4_t *cached = allocate_u4(nthresholds);
+
+  stackmark_t m = enterslot(slot, 0);
+  f4_t *s = allocate_f4((size_t) n*n);
+  f4_t *u = allocate_f4(n);
+  size_t const so = slot ? (size_t) (stack_begin - slot) : 0; // the sums stay
+  leaveslot(slot, m);
+
+  f4_t *x = localx(j);
+
+  for (u4_t k = w0; k < w1; k++) {
+    countread(x, (size_t) n * ((k == w0) ? l : 2*p) * sizeof(f4_t), 0);
+
+    u4_t t = acquire(windowcost(j, k == w0));
+    f8_t tr = tracebegin();
+    if (k == w0) {
+      memset(s, 0, (size_t) n*n * sizeof(f4_t));
+      memset(u, 0, n * sizeof(f4_t));
+      windowsums(x, s, u, k*p, l, 1.0f, n, j->m);
+    } else {
+      windowsums(x, s, u, (k-1)*p + l, p, 1.0f, n, j->m); // add
+      windowsums(x, s, u, (k-1)*p, p, -1.0f, n, j->m); // remove
+    }
+    traceend(trace_covariance, tr);
+    release(t);
+
+    u4_t const ii = i*nw+k;
+    if (pending(j, ii, cached) == 0) {
+      continue;
+    }
+
+    m = enterslot(slot, so);
+
+    f4_t *c = allocate_f4((size_t) n*n);
+
+    t = acquire(definitioncost(j, i));
+    tr = tracebegin();
+    sums2cov(s, u, c, n, l);
+    if (j->networkdefinitions[i] & ridge) {
+      singular(cov2precision(c, j->networkdefinitionparams[i], n));
+    }
+    cov2corr(c, n);
+    packsymmetric(c, n);
+    traceend(trace_covariance, tr);
+    release(t);
+
+    f4_t *w = keepdefinition(j, c);
+    leaveslot(slot, m);
+
+    thresholdcells(j, ii, w, cached);
+
+    free_definition(j, w, slot);
+  }
+
+  if (!slot) {
+    free_f4(n);
+    free_f4((size_t) n*n);
+  }
+  free_u4(nthresholds);
+
+  dismiss(slot);
+}
+
+static void jobtask(job_t *j) {
+  stackmark_t mark = mark_stack();
+
+  clalign_stack();
+  if (j->prepare) {
+    u4_t t = acquire(preparecost(j));
+    j->prepare(j);
+    release(t);
+  }
+  clalign_stack();
+
+  checkwindow(j);
+
+  if (j->cache && j->key == 0) { // prepare may know it
+    j->key = inputkey(j->x, j->n, j->m);
+  }
+
+  replicate(j);
+
+  u4_t const nw = nwindows(j);
+
+  u4_t nmeasuresglobal = 0;
+  for (u4_t i = 0; i < j->nmeasures; i++) {
+    if (j->measures[i] & global) {
+      nmeasuresglobal++;
+    }
+  }
+
+  size_t const nc = (size_t) nnetworks(j) * j->nthresholds;
+
+  // local measures are handed to emit cell by cell instead
+
+  j->og = allocate_f4(nc*nmeasuresglobal);
+  for (size_t i = 0; i < nc*nmeasuresglobal; i++) {
+    j->og[i] = NAN;
+  }
+
+  u4_t queued = 0;
+
+  for (u4_t i = 0; i < j->nmatrices; i++) {
+    unsigned char *slot = admit(j, &queued);
+    #pragma omp task firstprivate(i, slot)
+    matrixtask(j, i, slot);
+  }
+
+  u4_t const nd = (j->nmatrices > 0) ? 0 : j->nnetworkdefinitions;
+  for (u4_t i = 0; i < nd; i++) {
+    int const p = priority(definitioncost(j, i));
+    if (j->windowlength > 0) {
+      u4_t const r = DIV_UP(j->windowlength, j->windowstep);
+      for (u4_t k = 0; k < nw; k += r) {
+        u4_t const k1 = (k + r < nw) ? k + r : nw;
+        unsigned char *slot = admit(j, &queued);
+        #pragma omp task firstprivate(i, k, k1, slot) priority(p)
+        windowtask(j, i, k, k1, slot);
+      }
+    } else {
+      unsigned char *slot = admit(j, &queued);
+      #pragma omp task firstprivate(i, slot) priority(p)
+      definitiontask(j, i, slot);
+    }
+  }
+  #pragma omp taskwait
+
+  unreplicate(j);
+
+  if (j->finish) {
+    j->finish(j);
+  }
+
+  // the job's input and results live on this thread's stack until here
+
+  release_stack(mark);
+}
+
+// the size of the outer team, all threads if 0, and returns the previous
+// size. a single thread runs the cells in the same order every time
+u4_t scheduleteams(u4_t t) {
+  u4_t const p = teams;
+  teams = t;
+  return p;
+}
+
+// the bytes that the definitions of all jobs may take at the same time, no
+// limit if 0, and returns the previous budget. with a budget, definitions
+// are computed in slots of their own instead of on the stacks of the teams,
+// which need admittedjobsize instead of jobsize then
+size_t schedulememory(size_t b) {
+  size_t const p = budget;
+  budget = b;
+  return p;
+}
+
+void schedule(job_t *j, u4_t nj) {
+  progress = 0;
+  shown = 0;
+  busy = 0;
+
+  if (budget > 0) { // n and m are planned, prepare may only lower them
+    slotsize = 0;
+    for (u4_t k = 0; k < nj; k++) {
+      slotsize = MAX(slotsize, definitionsize(&j[k]));
+    }
+    nslots = (u4_t) MAX(budget / slotsize, 1);
+    region = (unsigned char*) allocate_interleaved(nslots * slotsize);
+    freeslots = (unsigned char**) allocate_ptr(nslots);
+    for (u4_t k = 0; k < nslots; k++) {
+      freeslots[k] = &region[(size_t) k * slotsize];
+    }
+    nfree = nslots;
+  }
+
+  ncells = 0; // n and m are planned before the inputs are read
+  for (u4_t k = 0; k < nj; k++) {
+    if (j[k].cellend > 0) {
+      ncells += j[k].cellend - j[k].cellbegin;
+    } else if (j[k].windowlength <= j[k].m) { // see checkwindow
+      ncells += nnetworks(&j[k]) * j[k].nthresholds;
+    }
+  }
+
+  u4_t const all = (u4_t) omp_get_max_threads();
+  u4_t const outer = teams > 0 ? teams : all;
+
+  if (omp_get_max_active_levels() < 2) {
+    omp_set_max_active_levels(2);
+  }
+
+  nodes = numanodes();
+  readlocal = 0;
+  readremote = 0;
+  readinterleaved = 0;
+  if (nodes > 1 && omp_get_proc_bind() == omp_proc_bind_false) {
+    fprintf(stderr, RED "Warning: threads are not bound to cores, so their memory may end up on other NUMA nodes. Set OMP_PROC_BIND." WHITE "\n");
+  }
+
+  #pragma omp parallel num_threads(outer)
+  #pragma omp single
+  {
+    u4_t inner = omp_get_max_threads(); // the nested team size
+
+    // a list such as OMP_NUM_THREADS=sockets,cores asks for all*inner cores,
+    // otherwise the nested size is all as well. fewer teams, e.g. for lack
+    // of memory, still share all cores
+    char const *e = getenv("OMP_NUM_THREADS");
+    cores = (e && strchr(e, ',')) ? all * inner : all;
+    if (debug) {
+      printf("scheduling %u jobs on %u cores\n", nj, cores);
+    }
+
+    for (u4_t k = 0; k < nj; k++) {
+      #pragma omp task firstprivate(k)
+      jobtask(&j[k]);
+    }
+  }
+
+  if (budget > 0) {
+    free_ptr(nslots);
+    free_numa(region, nslots * slotsize);
+  }
+
+  f8_t const r = (f8_t) (readlocal + readremote + readinterleaved);
+  if (r > 0.0) {
+    fprintf(stderr, "Of %.2f GB that the tasks read, %.1f%% were on the same NUMA node, %.1f%% on another and %.1f%% interleaved.\n",
+      r * 1e-9, 100.0 * readlocal / r, 100.0 * readremote / r, 100.0 * readinterleaved / r);
+  }
+}
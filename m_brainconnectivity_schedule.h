@@ -0,0 +1,134 @@
+// This library is part of Massive, copyright 2017 Lea Waller.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __M_BRAINCONNECTIVITY_SCHEDULE_H__
+#define __M_BRAINCONNECTIVITY_SCHEDULE_H__
+
+#include "m_common.h"
+
+#include "m_brainconnectivity_networkdefinition.h"
+#include "m_brainconnectivity_pathlength.h"
+#include "m_brainconnectivity_triangles.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+enum networkdefinition {
+  corr = 1 << 0,
+  ridge = 1 << 1
+};
+
+enum threshold {
+  absolute = 1 << 0,
+  proportional = 1 << 1,
+  nnegproportional = 1 << 2
+};
+
+enum measuredimensionality {
+  local = 1 << 0,
+  global = 1 << 1
+};
+
+enum measure {
+  charpath = 1 << 2,
+  clustering_coef = 1 << 3,
+  efficiency = 1 << 4
+};
+
+extern char const corr_str[];
+extern char const ridge_str[];
+
+extern char const absolute_str[];
+extern char const proportional_str[];
+extern char const nnegproportional_str[];
+
+extern char const window_str[];
+extern char const matrix_str[];
+
+extern char const global_str[];
+extern char const local_str[];
+
+extern char const charpath_str[];
+extern char const clustering_coef_str[];
+extern char const efficiency_str[];
+
+void networkdefinitiontostr(char *c, u4_t networkdefinition, f4_t param);
+void thresholdtostr(char *c, u4_t threshold, f4_t param);
+void windowtostr(char *c, u4_t k, u4_t windowlength, u4_t windowstep);
+void measuretostr(char *c, u4_t m);
+
+/* one network analysis, i.e. every combination of network definition,
+   threshold and measure for a single demeaned time series matrix. with
+   sliding windows, there is a network for every definition and window,
+   numbered i*nwindows+k. precomputed connectivity matrices skip the
+   definitions, and every matrix is a network
+*/
+typedef struct job job_t;
+
+struct job {
+  f4_t *x; // n nodes by m time points, node-major
+  f4_t **xr; // a copy of x on every NUMA node, set by the schedule
+  u4_t n;
+  u4_t m;
+  u4_t nmatrices; // or, if not 0, x holds that many connectivity matrices of
+  // n x n, which are the networks. m is n*nmatrices then
+
+  u4_t *networkdefinitions;
+  f4_t *networkdefinitionparams;
+  u4_t nnetworkdefinitions;
+
+  u4_t windowlength; // sliding windows of windowlength time points, moved
+  u4_t windowstep; // by windowstep, or the whole time series if 0
+
+  u4_t *thresholds;
+  f4_t *thresholdparams;
+  u4_t nthresholds;
+
+  u4_t *measures;
+  u4_t nmeasures;
+
+  f4_t *og; // measure x network x threshold
+
+  u4_t cellbegin; // only cells i*nthresholds+jj in [cellbegin, cellend) are
+  u4_t cellend; // computed, or all cells if cellend is 0
+
+  char *cache; // result cache directory, may be NULL
+  u4_t cachedefinitions; // also cache the definition matrices
+  u8_t key; // hash of x
+
+  void (*prepare)(job_t *j); // sets x, n and m, may be NULL
+  void (*emit)(job_t *j, f4_t *l, u4_t i, u4_t jj); // consumes the local measures of a cell, may be NULL
+  void (*finish)(job_t *j); // consumes og, may be NULL
+  void *arg;
+};
+
+u4_t nwindows(job_t *j);
+u4_t nnetworks(job_t *j);
+void networktostr(char *c, job_t *j, u4_t i);
+
+u4_t nlocalmeasures(job_t *j);
+f4_t *cellresult(job_t *j, f4_t *l, u4_t k, u4_t i, u4_t jj);
+
+void checkwindow(job_t *j);
+size_t jobsize(job_t *j);
+size_t admittedjobsize(job_t *j);
+size_t definitionsize(job_t *j);
+
+u4_t scheduleteams(u4_t t);
+size_t schedulememory(size_t b);
+void schedule(job_t *j, u4_t nj);
+
+#endif
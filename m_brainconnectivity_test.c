@@ -0,0 +1,930 @@
+// This library is part of Massive, copyright 2017 Lea Waller.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "m_brainconnectivity.h"
+#include "m_imaginggenetics_association.h"
+
+static const char usage[] = \
+"Usage: m_brainconnectivity_test <options>\n"\
+"\n"\
+"Compares the kernels of m_brainconnectivity with simple reference\n"\
+"implementations on random inputs, and exits with an error if any differ.\n"\
+"\n"\
+"-s <seed> seed of the random inputs, default 1\n"\
+"-r <rounds> random inputs per kernel and size, default 2\n"\
+"-t <threads> comma-separated list of thread counts, default 1,2,4\n"\
+"-v print every comparison, not only the failed ones\n";
+
+/* the references are written for clarity and compute in double precision.
+   graphs are random with a given density, and can have several components
+   (so some distances are infinite), ties (weights from a few levels only)
+   and negative weights. the kernels that assume nonnegative weights, as
+   after nnegproportional, only get those
+*/
+
+static u8_t rngstate;
+
+static u4_t verbose = 0;
+static u4_t nchecks = 0;
+static u4_t nfailed = 0;
+
+typedef struct {
+  f4_t density;
+  u4_t components;
+  u4_t levels; // 0 for continuous weights
+  u4_t negative;
+  u4_t symmetric; // otherwise directed from lower to higher nodes only
+} graph_t;
+
+static f4_t weight(graph_t const *g) {
+  f4_t v = uniform_f4(&rngstate);
+  if (g->levels > 0) {
+    v = (f4_t) (1 + (u4_t) (v * g->levels)) / (f4_t) g->levels;
+  }
+  if (g->negative && uniform_f4(&rngstate) < 0.3f) {
+    v = -v;
+  }
+  return v;
+}
+
+static void generategraph(f4_t *w, u4_t n, graph_t const *g) {
+  for (u4_t i = 0; i < n; i++) {
+    for (u4_t j = 0; j < n; j++) {
+      w[i*n+j] = 0.0f;
+    }
+  }
+  for (u4_t i = 0; i < n; i++) {
+    for (u4_t j = 0; j < n; j++) {
+      if (i == j || (i % g->components) != (j % g->components)) {
+        continue;
+      }
+      if (j > i) {
+        continue;
+      }
+      if (uniform_f4(&rngstate) < g->density) {
+        w[j*n+i] = weight(g);
+        if (g->symmetric) {
+          w[i*n+j] = w[j*n+i];
+        }
+      }
+    }
+  }
+}
+
+static u4_t differ(f8_t a, f8_t b, f8_t tol) {
+  if (isinf(a) || isinf(b)) {
+    return !(isinf(a) && isinf(b) && signbit(a) == signbit(b));
+  }
+  if (isnan(a) || isnan(b)) {
+    return 1;
+  }
+  return fabs(a - b) > tol * fmax(1.0, fabs(b));
+}
+
+static void check(char const *name, u4_t n, u4_t t,
+  f4_t *a, f8_t *b, size_t s, f8_t tol) {
+  size_t k = 0;
+  for (; k < s; k++) {
+    if (differ(a[k], b[k], tol)) {
+      break;
+    }
+  }
+
+  nchecks++;
+  if (k < s) {
+    nfailed++;
+    printf(RED "FAIL" WHITE "\t%s\tn=%u\tthreads=%u\tat %zu: %.9g != %.9g\n",
+      name, n, t, k, (f8_t) a[k], b[k]);
+  } else if (verbose) {
+    printf("ok\t%s\tn=%u\tthreads=%u\n", name, n, t);
+  }
+}
+
+// references
+
+static void referencefloydwarshall(f8_t *d, u4_t n) {
+  for (u4_t k = 0; k < n; k++) {
+    for (u4_t i = 0; i < n; i++) {
+      for (u4_t j = 0; j < n; j++) {
+        if (d[i*n+k] + d[k*n+j] < d[i*n+j]) {
+          d[i*n+j] = d[i*n+k] + d[k*n+j];
+        }
+      }
+    }
+  }
+}
+
+static void referencepathlength(f4_t *w, f8_t *r, f8_t *el, u4_t n) {
+  f8_t *d = (f8_t*) allocate_f8(n*n);
+  for (u4_t i = 0; i < n*n; i++) {
+    d[i] = (fabsf(w[i]) < FLT_EPSILON) ? INFINITY : 1.0 / (f8_t) w[i];
+  }
+  for (u4_t i = 0; i < n; i++) {
+    d[i*n+i] = 0.0;
+  }
+
+  referencefloydwarshall(d, n);
+
+  f8_t es = 0.0;
+  f8_t cps = 0.0;
+  u8_t k = 0;
+  for (u4_t i = 0; i < n; i++) {
+    el[i] = 0.0;
+    for (u4_t j = 0; j < n; j++) {
+      if (!isinf(d[i*n+j])) {
+        cps += d[i*n+j];
+        k++;
+      }
+      if (i != j && !isinf(d[i*n+j])) {
+        es += 1.0 / d[i*n+j];
+        el[i] += 1.0 / d[i*n+j];
+      }
+    }
+    el[i] /= (f8_t) (n - 1);
+  }
+
+  r[0] = es / ((f8_t) n * (n - 1));
+  r[1] = cps / (f8_t) k;
+
+  free_f8(n*n);
+}
+
+// weighted clustering coefficient of Onnela et al. 2005, per triangle
+static void referencetriangles(f4_t *w, f8_t *cl, f8_t *cg, u4_t n) {
+  f8_t *c = (f8_t*) allocate_f8(n*n);
+  for (u4_t i = 0; i < n; i++) {
+    for (u4_t j = 0; j < n; j++) {
+      c[i*n+j] = (i == j) ? 0.0 : cbrt((f8_t) w[i*n+j]);
+    }
+  }
+
+  f8_t s = 0.0;
+  for (u4_t i = 0; i < n; i++) {
+    f8_t f = 0.0;
+    u4_t k = 0;
+    for (u4_t j = 0; j < n; j++) {
+      if (c[i*n+j] != 0.0) {
+        k++;
+      }
+      for (u4_t h = 0; h < n; h++) {
+        f += c[i*n+j] * c[j*n+h] * c[h*n+i];
+      }
+    }
+    cl[i] = (k > 1) ? f / ((f8_t) k * (k - 1)) : 0.0;
+    s += cl[i];
+  }
+  *cg = s / (f8_t) n;
+
+  free_f8(n*n);
+}
+
+static int comparef4(void const *a, void const *b) {
+  f4_t x = *(f4_t const*) a;
+  f4_t y = *(f4_t const*) b;
+  return (x > y) - (x < y);
+}
+
+// by the values of sortvalues, then by index
+static f4_t const *sortvalues;
+
+static int compareindex(void const *a, void const *b) {
+  f8_t i = *(f8_t const*) a;
+  f8_t j = *(f8_t const*) b;
+  f4_t x = sortvalues[(size_t) i];
+  f4_t y = sortvalues[(size_t) j];
+  if (x != y) {
+    return (x > y) - (x < y);
+  }
+  return (i > j) - (i < j);
+}
+
+// kernels
+
+static void testsort(u4_t n, u4_t t) {
+  size_t const nn = (size_t) n*n;
+
+  f4_t *a = allocate_f4(nn);
+  f4_t *b = allocate_f4(nn);
+  f8_t *r = allocate_f8(nn);
+
+  for (size_t i = 0; i < nn; i++) {
+    a[i] = (f4_t) (u4_t) (uniform_f4(&rngstate) * 64.0f) - 32.0f; // ties
+  }
+  memcpy(b, a, nn * sizeof(f4_t));
+
+  qsort(b, nn, sizeof(f4_t), comparef4);
+  for (size_t i = 0; i < nn; i++) {
+    r[i] = b[i];
+  }
+  memcpy(b, a, nn * sizeof(f4_t));
+  psort(b, nn);
+  check("psort", n, t, b, r, nn, 0.0);
+  memcpy(b, a, nn * sizeof(f4_t));
+  radixsort(b, nn);
+  check("radixsort", n, t, b, r, nn, 0.0);
+  memcpy(b, a, nn * sizeof(f4_t));
+  samplesort(b, nn);
+  check("samplesort", n, t, b, r, nn, 0.0);
+
+  // mostly zeros, as after thresholding, and the extremes
+
+  for (size_t i = 0; i < nn; i++) {
+    f4_t const u = uniform_f4(&rngstate);
+    a[i] = (u < 0.8f) ? 0.0f : (u < 0.85f) ? -0.0f : (u < 0.86f) ? INFINITY : \
+      (u < 0.87f) ? -INFINITY : normal_f4(&rngstate);
+  }
+  memcpy(b, a, nn * sizeof(f4_t));
+  qsort(b, nn, sizeof(f4_t), comparef4);
+  for (size_t i = 0; i < nn; i++) {
+    r[i] = b[i];
+  }
+  memcpy(b, a, nn * sizeof(f4_t));
+  radixsort(b, nn);
+  check("radixsort zeros", n, t, b, r, nn, 0.0);
+  memcpy(b, a, nn * sizeof(f4_t));
+  samplesort(b, nn);
+  check("samplesort zeros", n, t, b, r, nn, 0.0);
+
+  // argsort is stable, so ties keep the order of their index
+
+  u4_t *o = allocate_u4(nn);
+  argsort(o, a, nn);
+  sortvalues = a;
+  for (size_t i = 0; i < nn; i++) {
+    b[i] = (f4_t) o[i];
+    r[i] = (f8_t) i;
+  }
+  qsort(r, nn, sizeof(f8_t), compareindex);
+  check("argsort", n, t, b, r, nn, 0.0);
+  free_u4(nn);
+
+  // proportional thresholds are read from the sorted weights
+
+  f4_t p[] = {0.0f, 0.1f, 0.25f, 0.5f, 1.0f};
+  u4_t const np = sizeof(p) / sizeof(p[0]);
+  f4_t tt[np];
+  f8_t rt[np];
+
+  for (size_t i = 0; i < nn; i++) {
+    a[i] = normal_f4(&rngstate);
+  }
+  memcpy(b, a, nn * sizeof(f4_t));
+  qsort(b, nn, sizeof(f4_t), comparef4);
+  for (u4_t i = 0; i < np; i++) {
+    u4_t k = (u4_t) (p[i] * (f4_t) nn);
+    rt[i] = b[(k > nn) ? 0 : (k == 0) ? nn - 1 : nn - k];
+    tt[i] = p[i];
+  }
+  memcpy(b, a, nn * sizeof(f4_t));
+  proportional2absolutethreshold(b, tt, n, np);
+  check("proportional2absolutethreshold", n, t, tt, rt, np, 0.0);
+
+  free_f8(nn);
+  free_f4(nn);
+  free_f4(nn);
+}
+
+// packed definitions give the same thresholds as the full matrix
+
+static void testpacked(u4_t n, u4_t t) {
+  size_t const nn = (size_t) n*n;
+  size_t const np = packedsize(n);
+
+  f4_t *a = allocate_f4(nn);
+  f4_t *b = allocate_f4(nn);
+  f4_t *c = allocate_f4(nn);
+  f8_t *r = allocate_f8(nn);
+
+  for (u4_t i = 0; i < n; i++) {
+    a[i*n+i] = 0.0f;
+    for (u4_t j = 0; j < i; j++) {
+      f4_t v = (uniform_f4(&rngstate) < 0.1f) ? 0.0f : normal_f4(&rngstate); // ties
+      a[i*n+j] = v;
+      a[j*n+i] = v;
+    }
+  }
+
+  memcpy(b, a, nn * sizeof(f4_t));
+  packsymmetric(b, n);
+  for (u4_t i = 0, k = 0; i < n; i++) {
+    for (u4_t j = i+1; j < n; j++) {
+      r[k++] = a[i*n+j];
+    }
+  }
+  check("packsymmetric", n, t, b, r, np, 0.0);
+
+  f4_t p[] = {0.0f, 0.01f, 0.1f, 0.25f, 0.5f, 0.75f, 1.0f};
+  u4_t const nq = sizeof(p) / sizeof(p[0]);
+  f4_t tt[nq];
+  f4_t tp[nq];
+  f8_t rt[nq];
+
+  memcpy(c, a, nn * sizeof(f4_t));
+  memcpy(tt, p, sizeof(p));
+  proportional2absolutethreshold(c, tt, n, nq);
+  for (u4_t i = 0; i < nq; i++) {
+    rt[i] = tt[i];
+  }
+
+  memcpy(c, b, np * sizeof(f4_t));
+  memcpy(tp, p, sizeof(p));
+  packedproportional2absolutethreshold(c, tp, n, nq);
+  check("packedproportional2absolutethreshold", n, t, tp, rt, nq, 0.0);
+
+  f4_t const th = tt[2];
+
+  memcpy(c, a, nn * sizeof(f4_t));
+  applyabsolutethreshold(c, th, n);
+  for (size_t i = 0; i < nn; i++) {
+    r[i] = c[i];
+  }
+  unpackthreshold(b, c, th, n);
+  check("unpackthreshold", n, t, c, r, nn, 0.0);
+
+  free_f8(nn);
+  free_f4(nn);
+  free_f4(nn);
+  free_f4(nn);
+}
+
+static void testfloydwarshall(u4_t n, u4_t t, graph_t const *g) {
+  size_t const nn = (size_t) n*n;
+
+  clalign_stack();
+  f4_t *w = allocate_f4(nn);
+  clalign_stack();
+  f4_t *a = allocate_f4(nn);
+  f8_t *r = allocate_f8(nn);
+
+  generategraph(w, n, g);
+  for (size_t i = 0; i < nn; i++) {
+    f4_t v = (w[i] == 0.0f) ? INFINITY : w[i];
+    w[i] = v;
+    r[i] = v;
+  }
+  for (u4_t i = 0; i < n; i++) {
+    w[i*n+i] = 0.0f;
+    r[i*n+i] = 0.0;
+  }
+  referencefloydwarshall(r, n);
+
+  memcpy(a, w, nn * sizeof(f4_t));
+  floydwarshall(a, n);
+  check("floydwarshall", n, t, a, r, nn, 1e-5);
+
+  memcpy(a, w, nn * sizeof(f4_t));
+  blockfloydwarshall(a, n);
+  check("blockfloydwarshall", n, t, a, r, nn, 1e-5);
+
+  free_f8(nn);
+  free_f4(nn);
+  free_f4(nn);
+}
+
+static void testmeasures(u4_t n, u4_t t, graph_t const *g) {
+  size_t const nn = (size_t) n*n;
+
+  f4_t *w = allocate_f4(nn);
+  f4_t *a = allocate_f4(nn);
+  f4_t *cl = allocate_f4(n);
+  f8_t *rl = allocate_f8(n);
+
+  generategraph(w, n, g);
+
+  f8_t r[2];
+  f4_t o[2];
+  referencepathlength(w, r, rl, n);
+  memcpy(a, w, nn * sizeof(f4_t));
+  pathlength(a, &o[0], cl, &o[1], n);
+  check("pathlength", n, t, o, r, 2, 1e-4);
+  check("pathlength local", n, t, cl, rl, n, 1e-4);
+
+  f8_t rg;
+  referencetriangles(w, rl, &rg, n);
+  for (u4_t i = 0; i < n; i++) {
+    cl[i] = 0.0f; // triangles leaves nodes without triangles alone
+  }
+  memcpy(a, w, nn * sizeof(f4_t));
+  triangles(a, &o[0], cl, n);
+  check("triangles global", n, t, o, &rg, 1, 1e-4);
+  check("triangles local", n, t, cl, rl, n, 1e-4);
+
+  free_f8(n);
+  free_f4(n);
+  free_f4(nn);
+  free_f4(nn);
+}
+
+static void testcovariance(u4_t n, u4_t t) {
+  u4_t const m = 3*n + 7;
+  u4_t const l = n + 3;
+  u4_t const p = 2;
+
+  size_t const nn = (size_t) n*n;
+
+  f4_t *x = allocate_f4((size_t) n*m);
+  f4_t *c = allocate_f4(nn);
+  f4_t *s = allocate_f4(nn);
+  f4_t *u = allocate_f4(n);
+  f8_t *r = allocate_f8(nn);
+
+  for (u4_t i = 0; i < n; i++) {
+    f4_t q = 0.0f;
+    for (u4_t k = 0; k < m; k++) {
+      x[i*m+k] = normal_f4(&rngstate) + (f4_t) (i % 3);
+      q += x[i*m+k];
+    }
+    q /= (f4_t) m;
+    for (u4_t k = 0; k < m; k++) {
+      x[i*m+k] -= q;
+    }
+  }
+
+  for (u4_t i = 0; i < n; i++) {
+    for (u4_t j = 0; j < n; j++) {
+      f8_t v = 0.0;
+      for (u4_t k = 0; k < m; k++) {
+        v += (f8_t) x[i*m+k] * x[j*m+k];
+      }
+      r[i*n+j] = v / (f8_t) (m - 1);
+    }
+  }
+  cov(x, c, n, m);
+  check("cov", n, t, c, r, nn, 1e-4);
+
+  // the third window, reached by moving the sums twice
+
+  u4_t const b = 2*p;
+  for (u4_t i = 0; i < n; i++) {
+    for (u4_t j = 0; j < n; j++) {
+      f8_t v = 0.0;
+      f8_t ui = 0.0;
+      f8_t uj = 0.0;
+      for (u4_t k = b; k < b + l; k++) {
+        v += (f8_t) x[i*m+k] * x[j*m+k];
+        ui += x[i*m+k];
+        uj += x[j*m+k];
+      }
+      r[i*n+j] = (v - ui * uj / (f8_t) l) / (f8_t) (l - 1);
+    }
+  }
+  memset(s, 0, nn * sizeof(f4_t));
+  memset(u, 0, n * sizeof(f4_t));
+  windowsums(x, s, u, 0, l, 1.0f, n, m);
+  for (u4_t k = 1; k <= 2; k++) {
+    windowsums(x, s, u, (k-1)*p + l, p, 1.0f, n, m);
+    windowsums(x, s, u, (k-1)*p, p, -1.0f, n, m);
+  }
+  sums2cov(s, u, c, n, l);
+  check("windowsums", n, t, c, r, nn, 1e-3);
+
+  free_f8(nn);
+  free_f4(n);
+  free_f4(nn);
+  free_f4(nn);
+  free_f4((size_t) n*m);
+}
+
+/* every window of windowtask, as the running sums give it, against cov and
+   ridgecov of that window alone. the sums are moved over all windows in
+   one run, longer than windowtask ever moves them, so that the drift of
+   the updates is bounded here
+*/
+static void testwindows(u4_t n, u4_t t) {
+  u4_t const l = n + 3;
+  u4_t const p = 2;
+  u4_t const nw = 64;
+  u4_t const m = l + (nw - 1) * p;
+  f4_t const rho = 2.0f;
+
+  size_t const nn = (size_t) n*n;
+
+  f4_t *x = allocate_f4((size_t) n*m);
+  f4_t *xw = allocate_f4((size_t) n*l);
+  f4_t *s = allocate_f4(nn);
+  f4_t *u = allocate_f4(n);
+  f4_t *c = allocate_f4(nn);
+  f4_t *a = allocate_f4(2 * nw * nn); // correlation, ridge
+  f8_t *r = allocate_f8(2 * nw * nn);
+
+  for (size_t i = 0; i < (size_t) n*m; i++) {
+    x[i] = normal_f4(&rngstate) + (f4_t) (i / m % 3); // means that cancel
+  }
+
+  for (u4_t k = 0; k < nw; k++) {
+    if (k == 0) {
+      memset(s, 0, nn * sizeof(f4_t));
+      memset(u, 0, n * sizeof(f4_t));
+      windowsums(x, s, u, 0, l, 1.0f, n, m);
+    } else {
+      windowsums(x, s, u, (k-1)*p + l, p, 1.0f, n, m); // add
+      windowsums(x, s, u, (k-1)*p, p, -1.0f, n, m); // remove
+    }
+
+    for (u4_t q = 0; q < 2; q++) {
+      f4_t *o = &a[(q*nw + k) * nn];
+      sums2cov(s, u, o, n, l);
+      if (q == 1 && cov2precision(o, rho, n) != 0) {
+        memset(o, 0, nn * sizeof(f4_t));
+      }
+      cov2corr(o, n);
+    }
+
+    for (u4_t i = 0; i < n; i++) { // the window alone, demeaned
+      f4_t q = 0.0f;
+      for (u4_t j = 0; j < l; j++) {
+        xw[i*l+j] = x[i*m + k*p + j];
+        q += xw[i*l+j];
+      }
+      q /= (f4_t) l;
+      for (u4_t j = 0; j < l; j++) {
+        xw[i*l+j] -= q;
+      }
+    }
+    for (u4_t q = 0; q < 2; q++) {
+      if (q == 0) {
+        cov(xw, c, n, l);
+      } else if (ridgecov(xw, c, rho, n, l) != 0) {
+        memset(c, 0, nn * sizeof(f4_t));
+      }
+      cov2corr(c, n);
+      for (size_t i = 0; i < nn; i++) {
+        r[(q*nw + k) * nn + i] = c[i];
+      }
+    }
+  }
+
+  check("windows corr", n, t, a, r, nw * nn, 1e-4);
+  check("windows ridge", n, t, &a[nw * nn], &r[nw * nn], nw * nn, 1e-4);
+
+  free_f8(2 * nw * nn);
+  free_f4(2 * nw * nn);
+  free_f4(nn);
+  free_f4(n);
+  free_f4(nn);
+  free_f4((size_t) n*l);
+  free_f4((size_t) n*m);
+}
+
+// two-sided p value of t with df degrees of freedom, by simpson's rule
+static f8_t referencetp(f8_t t, f8_t df) {
+  u4_t const m = 4096;
+  f8_t const c = exp(lgamma(0.5*(df+1.0)) - lgamma(0.5*df)) / sqrt(df * M_PI);
+  f8_t const h = fabs(t) / m;
+  f8_t v = 0.0;
+  for (u4_t i = 0; i <= m; i++) {
+    f8_t const x = i*h;
+    f8_t const w = (i == 0 || i == m) ? 1.0 : (i % 2) ? 4.0 : 2.0;
+    v += w * c * pow(1.0 + x*x/df, -0.5*(df+1.0));
+  }
+  return 1.0 - 2.0 * v * h / 3.0;
+}
+
+static void testassociation(u4_t n, u4_t t) {
+  u4_t const ns = 37;
+  u4_t const k = 3;
+  u4_t const m = n + 3; // subjects
+  u4_t const fixed[3] = {2, 3, 0}; // never monomorphic
+  size_t const v = DIV_UP(m, 4);
+
+  unsigned char *g = (unsigned char*) allocate_u1((size_t) ns*v);
+  u4_t *c = allocate_u4((size_t) ns*m);
+  f4_t *y = allocate_f4((size_t) m*k);
+  f4_t *o = allocate_f4((size_t) ns*k*nassociation);
+  f8_t *r = allocate_f8((size_t) ns*k*nassociation);
+
+  memset(g, 0, (size_t) ns*v);
+  for (u4_t s = 0; s < ns; s++) {
+    for (u4_t i = 0; i < m; i++) {
+      u4_t e = (u4_t) (uniform_f4(&rngstate) * 4.0f) & 3;
+      if (i < 3) {
+        e = fixed[i];
+      }
+      c[s*m+i] = e;
+      g[(size_t) s*v + i/4] |= (unsigned char) (e << (2*(i%4)));
+    }
+  }
+  for (size_t i = 0; i < (size_t) m*k; i++) {
+    y[i] = 3.0f * normal_f4(&rngstate) + 10.0f;
+  }
+
+  for (u4_t s = 0; s < ns; s++) {
+    for (u4_t q = 0; q < k; q++) {
+      f8_t nn = 0.0, sg = 0.0, sy = 0.0;
+      for (u4_t i = 0; i < m; i++) {
+        u4_t const e = c[s*m+i];
+        if (e != 1) {
+          nn += 1.0;
+          sg += (e == 3) ? 2.0 : (e == 2) ? 1.0 : 0.0;
+          sy += y[(size_t) q*m+i];
+        }
+      }
+      f8_t gg = 0.0, gy = 0.0;
+      for (u4_t i = 0; i < m; i++) {
+        u4_t const e = c[s*m+i];
+        if (e != 1) {
+          f8_t const x = ((e == 3) ? 2.0 : (e == 2) ? 1.0 : 0.0) - sg / nn;
+          gg += x*x;
+          gy += x * (y[(size_t) q*m+i] - sy / nn);
+        }
+      }
+      f8_t const b = gy / gg;
+      f8_t ee = 0.0;
+      for (u4_t i = 0; i < m; i++) {
+        u4_t const e = c[s*m+i];
+        if (e != 1) {
+          f8_t const x = ((e == 3) ? 2.0 : (e == 2) ? 1.0 : 0.0) - sg / nn;
+          f8_t const z = y[(size_t) q*m+i] - sy / nn - b*x;
+          ee += z*z;
+        }
+      }
+      f8_t *rr = &r[((size_t) s*k+q) * nassociation];
+      rr[association_beta] = b;
+      rr[association_se] = sqrt(ee / (nn - 2.0) / gg);
+      rr[association_t] = b / rr[association_se];
+      rr[association_p] = referencetp(rr[association_t], nn - 2.0);
+    }
+  }
+
+  association(g, v, ns, m, y, k, o);
+  check("association", m, t, o, r, (size_t) ns*k*nassociation, 1e-3);
+
+  free_f8((size_t) ns*k*nassociation);
+  free_f4((size_t) ns*k*nassociation);
+  free_f4((size_t) m*k);
+  free_u4((size_t) ns*m);
+  free_u1((size_t) ns*v);
+}
+
+/* more subjects than teams, each team generating the definitions of its
+   subject, against a budget of a single definition at a time. the measures
+   have to match those of a run without a budget, and a schedule that stops
+   making progress is ended by the alarm
+*/
+/* read_txt_columns_f4 against strtof of the same tokens. the file has a
+   header line, CRLF and LF line ends, trailing blanks, blank lines,
+   exponents down to subnormals, and mantissas that the fast path cannot
+   take: more than 19 digits, and halfway cases between two floats
+*/
+static void testtxt(u4_t n, u4_t t) {
+  u4_t const nc = 5;
+  size_t const s = (size_t) n*nc;
+
+  f8_t *r = allocate_f8(s);
+  f4_t *d;
+  u4_t nn[2];
+
+  char f[] = "/tmp/m_brainconnectivity_testXXXXXX";
+  int fd = mkstemp(f);
+  FILE *fp = (fd >= 0) ? fdopen(fd, "w") : NULL;
+  if (fp == NULL) {
+    fprintf(stderr, RED "Error: cannot write a temporary file." WHITE "\n");
+    exit(EXIT_FAILURE);
+  }
+
+  fputs("plain\texponent long halfway integer  \r\n", fp);
+  for (u4_t i = 0; i < n; i++) {
+    for (u4_t j = 0; j < nc; j++) {
+      char a[128];
+      f4_t const x = normal_f4(&rngstate);
+      switch (j) {
+        case 0:
+          snprintf(a, sizeof(a), "%.3f", x);
+          break;
+        case 1: {
+          int const e = (int) (uniform_f4(&rngstate) * 84.0f) - 46;
+          snprintf(a, sizeof(a), (i % 2) ? "%.6e" : "%.8E", x * pow(10.0, e));
+          break;
+        }
+        case 2:
+          snprintf(a, sizeof(a), "%.25g", (f8_t) x / 3.0);
+          break;
+        case 3: // exact in f8, between x and the next float
+          snprintf(a, sizeof(a), "%.40g", ((f8_t) x + nextafterf(x, INFINITY)) / 2.0);
+          break;
+        default:
+          snprintf(a, sizeof(a), "%llu%08u", (unsigned long long) rngstate, i);
+      }
+      r[(size_t) j*n+i] = strtof(a, NULL);
+      fputs(a, fp);
+      fputs((j + 1 < nc) ? ((i + j) % 3 ? " " : "\t") : "", fp);
+    }
+    fputs((i % 4 == 1) ? " \t " : "", fp);
+    fputs((i % 2) ? "\r\n" : "\n", fp);
+    fputs((i % 7 == 3) ? "\r\n" : "", fp);
+  }
+  fclose(fp);
+
+  read_txt_columns_f4(f, nn, &d);
+  unlink(f);
+
+  f4_t dd[2] = {nn[0], nn[1]};
+  f8_t rr[2] = {n, nc};
+  check("txt dimensions", n, t, dd, rr, 2, 0.0);
+  if (nn[0] == n && nn[1] == nc) {
+    check("txt", n, t, d, r, s, 0.0);
+  }
+
+  free_f4((size_t) nn[0]*nn[1]);
+  free_f8(s);
+}
+
+static void finishschedule(job_t *j) {
+  size_t const nc = (size_t) nnetworks(j) * j->nthresholds;
+  memcpy(j->arg, j->og, nc * sizeof(f4_t)); // one global measure
+}
+
+// windows of l time points moved by l/2, or none if l is 0
+static void testschedule(u4_t n, u4_t teams, u4_t l) {
+  u4_t const nj = 2*teams + 1;
+  u4_t const m = 2*n + 5;
+  u4_t const nw = (l > 0) ? (m - l) / (l/2) + 1 : 1;
+
+  u4_t networkdefinitions[2] = {corr, ridge};
+  f4_t networkdefinitionparams[2] = {0.0f, 2.0f};
+  u4_t thresholds[2] = {proportional, absolute};
+  f4_t thresholdparams[2] = {0.2f, 0.1f};
+  u4_t measures[1] = {global | charpath};
+  size_t const nc = 2*nw*2;
+
+  stackmark_t mark = mark_stack();
+
+  #pragma omp parallel num_threads(teams)
+  if (omp_get_thread_num() > 0) {
+    allocate_stack(0);
+  }
+
+  job_t *j = (job_t*) allocate_u1(nj * sizeof(job_t));
+  f4_t *x = allocate_f4((size_t) nj*n*m);
+  f4_t *o = allocate_f4(2*nj*nc);
+  f8_t *r = allocate_f8(nj*nc);
+
+  for (size_t i = 0; i < (size_t) nj*n; i++) {
+    f4_t q = 0.0f;
+    for (u4_t k = 0; k < m; k++) {
+      x[i*m+k] = normal_f4(&rngstate);
+      q += x[i*m+k];
+    }
+    q /= (f4_t) m;
+    for (u4_t k = 0; k < m; k++) {
+      x[i*m+k] -= q;
+    }
+  }
+
+  for (u4_t q = 0; q < 2; q++) { // without, then with a budget
+    for (u4_t k = 0; k < nj; k++) {
+      job_t jj = {
+        .x = &x[(size_t) k*n*m],
+        .n = n,
+        .m = m,
+        .windowlength = l,
+        .windowstep = l/2,
+        .networkdefinitions = networkdefinitions,
+        .networkdefinitionparams = networkdefinitionparams,
+        .nnetworkdefinitions = 2,
+        .thresholds = thresholds,
+        .thresholdparams = thresholdparams,
+        .nthresholds = 2,
+        .measures = measures,
+        .nmeasures = 1,
+        .finish = finishschedule,
+        .arg = &o[((size_t) q*nj+k)*nc]
+      };
+      j[k] = jj;
+    }
+
+    size_t const b = schedulememory(q ? definitionsize(&j[0]) : 0);
+    u4_t const tt = scheduleteams(teams);
+    alarm(60);
+    schedule(j, nj);
+    alarm(0);
+    scheduleteams(tt);
+    schedulememory(b);
+  }
+
+  for (size_t i = 0; i < nj*nc; i++) {
+    r[i] = o[i];
+  }
+  check(l > 0 ? "schedule windows with a budget" : "schedule with a budget", n, teams, &o[nj*nc], r, nj*nc, 1e-5);
+
+  release_stack(mark);
+}
+
+static u4_t parsethreads(char *c, u4_t *t) {
+  u4_t k = 0;
+  char *s;
+  for (char *tok = strtok_r(c, ",", &s); tok && k < 64; tok = strtok_r(NULL, ",", &s)) {
+    int v = atoi(tok);
+    if (v < 1) {
+      fprintf(stderr, RED "Error: invalid thread count %s." WHITE "\n\n%s", tok, usage);
+      exit(EXIT_FAILURE);
+    }
+    t[k++] = (u4_t) v;
+  }
+  return k;
+}
+
+int main(int argc, char* argv[]) {
+  fputs(version, stderr);
+
+  u8_t seed = 1;
+  u4_t nrounds = 2;
+
+  u4_t threads[64] = {1, 2, 4};
+  u4_t nthreads = 3;
+
+  char cc;
+  while ((cc = getopt(argc, argv, "s:r:t:v")) != -1) {
+    switch (cc) {
+      case 's':
+        seed = strtoull(optarg, NULL, 10);
+        break;
+      case 'r':
+        nrounds = atoi(optarg);
+        break;
+      case 't':
+        nthreads = parsethreads(optarg, &threads[0]);
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      default:
+        fprintf(stderr, "%s", usage);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  rngstate = 0x9e3779b97f4a7c15ULL ^ (seed * 0xbf58476d1ce4e5b9ULL);
+
+  omp_set_dynamic(0);
+  #ifdef __INTEL_MKL__
+    mkl_set_dynamic(0);
+  #endif
+
+  allocate_stack(0);
+
+  // around the tile size of blockfloydwarshall, which is 128
+
+  u4_t const sizes[] = {2, 5, 33, 127, 128, 129, 200, 300};
+  u4_t const nsizes = sizeof(sizes) / sizeof(sizes[0]);
+
+  graph_t const graphs[] = {
+    {0.3f, 1, 0, 0, 1},
+    {0.05f, 1, 0, 0, 1}, // sparse, some nodes isolated
+    {0.5f, 3, 0, 0, 1}, // disconnected
+    {0.4f, 1, 4, 0, 1}, // ties
+  };
+  u4_t const ngraphs = sizeof(graphs) / sizeof(graphs[0]);
+
+  // directed and acyclic, so negative weights have no negative cycles
+  graph_t const negative = {0.3f, 2, 0, 1, 0};
+
+  for (u4_t p = 0; p < nthreads; p++) {
+    omp_set_num_threads(threads[p]);
+    #ifdef __INTEL_MKL__
+      mkl_set_num_threads(threads[p]);
+    #endif
+
+    for (u4_t q = 0; q < nsizes; q++) {
+      u4_t const n = sizes[q];
+      for (u4_t r = 0; r < nrounds; r++) {
+        stackmark_t mark = mark_stack();
+
+        testsort(n, threads[p]);
+        testpacked(n, threads[p]);
+        testcovariance(n, threads[p]);
+        testwindows(n, threads[p]);
+        testassociation(n, threads[p]);
+        testtxt(n, threads[p]);
+
+        for (u4_t k = 0; k < ngraphs; k++) {
+          testfloydwarshall(n, threads[p], &graphs[k]);
+          testmeasures(n, threads[p], &graphs[k]);
+        }
+
+        testfloydwarshall(n, threads[p], &negative);
+
+        release_stack(mark);
+      }
+    }
+  }
+
+  testschedule(40, 2, 0);
+  testschedule(40, 2, 50);
+
+  printf("%u of %u checks passed\n", nchecks - nfailed, nchecks);
+
+  return (nfailed > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
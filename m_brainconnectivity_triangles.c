@@ -15,7 +15,7 @@
 
 #include "m_brainconnectivity_triangles.h"
 
-void triangles(f4_t * restrict c,
+DISPATCH void triangles(f4_t * restrict c,
   f4_t * restrict cg, f4_t * restrict cl,
   u4_t n) {
 
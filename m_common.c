@@ -23,6 +23,190 @@ const char version[] = "Massive " VERSION " " __DATE__  " " __TIME__ "\n" \
 "http://github.com/HippocampusGirl/Massive\n" \
 "(c) 2017 Lea Waller, GNU General Public License v3.0\n\n";
 
+// a simple 64 bit hash, mixing eight bytes at a time with the multiplier
+// from https://github.com/aappleby/smhasher, MurmurHash3.cpp
+u8_t hash_u1(u8_t h, unsigned char *p, size_t s) {
+  u8_t const k = 0xff51afd7ed558ccdULL;
+
+  size_t i = 0;
+  for (; i + sizeof(u8_t) <= s; i += sizeof(u8_t)) {
+    u8_t w;
+    memcpy(&w, &p[i], sizeof(u8_t));
+    h = (h ^ w) * k;
+    h ^= h >> 33;
+  }
+  for (; i < s; i++) {
+    h = (h ^ p[i]) * k;
+    h ^= h >> 33;
+  }
+
+  h ^= (u8_t) s;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// xorshift64*, see https://en.wikipedia.org/wiki/Xorshift, in (0, 1)
+f4_t uniform_f4(u8_t *s) {
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  u8_t r = *s * 0x2545f4914f6cdd1dULL;
+  return ((f4_t) (r >> 40) + 0.5f) / 16777216.0f;
+}
+
+f4_t normal_f4(u8_t *s) {
+  f4_t u = uniform_f4(s);
+  f4_t v = uniform_f4(s);
+  return sqrtf(-2.0f * logf(u)) * cosf(2.0f * (f4_t) M_PI * v);
+}
+
+// the clones of the DISPATCH kernels that the loader picked
+char const *kernellevel() {
+#ifdef MASSIVE_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("x86-64-v4")) {
+    return "x86-64-v4";
+  }
+  if (__builtin_cpu_supports("x86-64-v3")) {
+    return "x86-64-v3";
+  }
+  if (__builtin_cpu_supports("x86-64-v2")) {
+    return "x86-64-v2";
+  }
+  return "x86-64";
+#else
+  return "native";
+#endif
+}
+
+/* every thread records its events into its own buffer, so tracing takes
+   no locks except when a thread records its first event. the buffers are
+   written as a chrome trace (chrome://tracing, ui.perfetto.dev) at the
+   end, together with a summary per stage on stderr
+*/
+
+u4_t tracing = 0;
+
+static char const *tracestages[] = {
+  "read", "demean", "covariance", "threshold",
+  "floydwarshall", "triangles", "output"
+};
+
+typedef struct {
+  u4_t s;
+  f8_t b;
+  f8_t e;
+} traceevent_t;
+
+typedef struct tracebuffer tracebuffer_t;
+struct tracebuffer {
+  traceevent_t *e;
+  size_t n;
+  size_t c;
+  u4_t tid;
+  tracebuffer_t *next;
+};
+
+static tracebuffer_t *tracebuffers = NULL;
+static u4_t ntracebuffers = 0;
+static f8_t traceorigin;
+
+static tracebuffer_t *tracebuffer = NULL;
+#pragma omp threadprivate(tracebuffer)
+
+void starttrace() {
+  traceorigin = omp_get_wtime();
+  tracing = 1;
+}
+
+f8_t tracebegin() {
+  return tracing ? omp_get_wtime() : 0.0;
+}
+
+void traceend(u4_t s, f8_t b) {
+  if (!tracing) {
+    return;
+  }
+
+  f8_t e = omp_get_wtime();
+
+  tracebuffer_t *t = tracebuffer;
+  if (!t) {
+    t = (tracebuffer_t*) calloc(1, sizeof(tracebuffer_t));
+    if (!t) {
+      fprintf(stderr, RED "Error: failed to allocate trace buffer." WHITE "\n");
+      exit(EXIT_FAILURE);
+    }
+    #pragma omp critical(trace)
+    {
+      t->tid = ntracebuffers++;
+      t->next = tracebuffers;
+      tracebuffers = t;
+    }
+    tracebuffer = t;
+  }
+
+  if (t->n == t->c) {
+    t->c = t->c ? 2 * t->c : 1024;
+    t->e = (traceevent_t*) realloc(t->e, t->c * sizeof(traceevent_t));
+    if (!t->e) {
+      fprintf(stderr, RED "Error: failed to allocate trace buffer." WHITE "\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  traceevent_t *ev = &t->e[t->n++];
+  ev->s = s;
+  ev->b = b - traceorigin;
+  ev->e = e - traceorigin;
+}
+
+void writetrace(char *f, u4_t pid) {
+  f8_t const wall = omp_get_wtime() - traceorigin;
+
+  FILE *fp = fopen(f, "w");
+  if (!fp) {
+    fprintf(stderr, RED "Failed to open %s for writing." WHITE "\n", f);
+    exit(EXIT_FAILURE);
+  }
+
+  u8_t count[ntracestages] = {0};
+  f8_t total[ntracestages] = {0.0};
+  f8_t max[ntracestages] = {0.0};
+
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  u4_t first = 1;
+  for (tracebuffer_t *t = tracebuffers; t; t = t->next) {
+    for (size_t i = 0; i < t->n; i++) {
+      traceevent_t *ev = &t->e[i];
+      f8_t d = ev->e - ev->b;
+
+      fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u}",
+        first ? "" : ",\n", tracestages[ev->s], ev->b * 1e6, d * 1e6, pid, t->tid);
+      first = 0;
+
+      count[ev->s]++;
+      total[ev->s] += d;
+      if (d > max[ev->s]) {
+        max[ev->s] = d;
+      }
+    }
+  }
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
+
+  fprintf(stderr, "\n%-16s%12s%14s%14s%14s\n", "stage", "count", "total s", "mean ms", "max ms");
+  for (u4_t s = 0; s < ntracestages; s++) {
+    if (count[s] == 0) {
+      continue;
+    }
+    fprintf(stderr, "%-16s%12llu%14.3f%14.3f%14.3f\n", tracestages[s],
+      (unsigned long long) count[s], total[s], total[s] / count[s] * 1e3, max[s] * 1e3);
+  }
+  fprintf(stderr, "%-16s%12u%14.3f\n", "wall (threads)", ntracebuffers, wall);
+}
+
 void showprogress(u4_t i, u4_t n) {
   if (!debug) {
     if (i > 0) {
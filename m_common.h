@@ -46,6 +46,34 @@ extern u4_t debug;
 // taken from https://github.com/chrchang/plink-ng, plink2/pgenlib_internal.h
 #define DIV_UP(val, divisor) (((val) + (divisor) - 1) / (divisor))
 
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+u8_t hash_u1(u8_t h, unsigned char *p, size_t s);
+
+f4_t uniform_f4(u8_t *s);
+f4_t normal_f4(u8_t *s);
+
+char const *kernellevel();
+
+// stages of a job that are timed when tracing is enabled
+enum {
+  trace_read = 0,
+  trace_demean,
+  trace_covariance,
+  trace_threshold,
+  trace_floydwarshall,
+  trace_triangles,
+  trace_output,
+  ntracestages
+};
+
+extern u4_t tracing;
+
+void starttrace();
+f8_t tracebegin();
+void traceend(u4_t s, f8_t b);
+void writetrace(char *f, u4_t pid);
+
 void showprogress(u4_t i, u4_t n);
 void printmatrix(f4_t *a, u4_t n, u4_t m);
 
@@ -17,6 +17,10 @@
 
 static inline void lc(char *f, u4_t *l) {
   FILE *fp = fopen(f, "r");
+  if (!fp) {
+    fprintf(stderr, RED "Failed to open %s for reading." WHITE "\n", f);
+    exit(EXIT_FAILURE);
+  }
 
   *l = 0;
 
@@ -101,6 +105,102 @@ void write_ntxt_f4(char *f, u4_t *n,
   fclose(fp);
 }
 
+/* .npy files of float32 in C order, with the d dimensions n. the header is
+   padded to 64 bytes like numpy does, so its size only depends on n, and
+   blocks of the array can be written in any order by any thread or process
+   before the header is
+*/
+static size_t npyheader(char *h, u4_t const *n, u4_t d) {
+  char c[192];
+  int k = snprintf(c, sizeof(c), "{'descr': '<f4', 'fortran_order': False, 'shape': (");
+  for (u4_t i = 0; i < d; i++) {
+    k += snprintf(&c[k], sizeof(c) - k, (i + 1 < d) ? "%u, " : "%u,", n[i]);
+  }
+  k += snprintf(&c[k], sizeof(c) - k, "), }");
+
+  size_t const l = DIV_UP(10 + k + 1, 64) * 64; // and a newline
+  if (h) {
+    memcpy(h, "\x93NUMPY\x01\x00", 8);
+    h[8] = (char) ((l - 10) & 0xff);
+    h[9] = (char) ((l - 10) >> 8);
+    memcpy(&h[10], c, k);
+    memset(&h[10 + k], ' ', l - 10 - k - 1);
+    h[l - 1] = '\n';
+  }
+  return l;
+}
+
+static void pwritefile(int fd, char *f, void const *b, size_t s, size_t o) {
+  unsigned char const *p = (unsigned char const*) b;
+  while (s > 0) {
+    ssize_t const r = pwrite(fd, p, s, (off_t) o);
+    if (r <= 0) {
+      fprintf(stderr, RED "Failed to write %s." WHITE "\n", f);
+      exit(EXIT_FAILURE);
+    }
+    p += r;
+    o += (size_t) r;
+    s -= (size_t) r;
+  }
+}
+
+static int opennpy(char *f) {
+  int fd = open(f, O_WRONLY | O_CREAT, 0644);
+  if (fd < 0) {
+    fprintf(stderr, RED "Failed to open %s for writing." WHITE "\n", f);
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+// writes s values of e at offset o of the array
+void write_npy_block_f4(char *f, u4_t const *n, u4_t d,
+    size_t o, f4_t const *e, size_t s) {
+  int fd = opennpy(f);
+  pwritefile(fd, f, e, s * sizeof(f4_t), npyheader(NULL, n, d) + o * sizeof(f4_t));
+  close(fd);
+}
+
+// writes the header once all blocks are, and cuts off what an earlier file left
+void write_npy_header_f4(char *f, u4_t const *n, u4_t d) {
+  char h[256];
+  size_t const l = npyheader(h, n, d);
+
+  size_t s = 1;
+  for (u4_t i = 0; i < d; i++) {
+    s *= n[i];
+  }
+
+  int fd = opennpy(f);
+  pwritefile(fd, f, h, l, 0);
+  if (ftruncate(fd, (off_t) (l + s * sizeof(f4_t))) != 0) {
+    fprintf(stderr, RED "Failed to write %s." WHITE "\n", f);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+}
+
+// maps the array of f read-only and sets e to it. returns the mapping of s bytes
+void *map_npy_f4(char *f, u4_t const *n, u4_t d, f4_t **e, size_t *s) {
+  int fd = open(f, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, RED "Failed to open %s for reading." WHITE "\n", f);
+    exit(EXIT_FAILURE);
+  }
+
+  *s = (size_t) st.st_size;
+  void *b = mmap(NULL, *s, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (b == MAP_FAILED) {
+    fprintf(stderr, RED "Failed to map %s for reading." WHITE "\n", f);
+    exit(EXIT_FAILURE);
+  }
+
+  *e = (f4_t*) ((unsigned char*) b + npyheader(NULL, n, d));
+  return b;
+}
+
 void read_genotype(char *b, u4_t *n,
     u4_t **g) {
   char *c = &b[strlen(b)];
@@ -125,7 +225,7 @@ void read_genotype(char *b, u4_t *n,
   unsigned char mb[3];
   fread(&mb[0], 1, 3, fp);
 
-  if (mb[0] != 0x6c || mb[1] != 0x1b || mb[2] == 0x01) {
+  if (mb[0] != 0x6c || mb[1] != 0x1b || mb[2] != 0x01) { // snp-major
     fprintf(stderr, RED "Invalid genotype fileset." WHITE "\n");
     exit(EXIT_FAILURE);
   }
@@ -141,27 +241,133 @@ void read_genotype(char *b, u4_t *n,
   fclose(fp);
 }
 
+/* maps the genotypes of the fileset b instead of reading them, so that
+   blocks of snps can be streamed from the page cache. the snps follow
+   the magic, v bytes each
+*/
+void map_genotype(char *b, genotype_t *g) {
+  char c[4096];
+
+  snprintf(c, sizeof(c), "%s.fam", b);
+  lc(c, &g->n);
+
+  snprintf(c, sizeof(c), "%s.bim", b);
+  lc(c, &g->ns);
+
+  snprintf(c, sizeof(c), "%s.bed", b);
+
+  g->v = DIV_UP(g->n, 4);
+  g->size = 3 + g->v * g->ns;
+
+  int fd = open(c, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, RED "Failed to open %s for reading." WHITE "\n", c);
+    exit(EXIT_FAILURE);
+  }
+  if ((size_t) st.st_size != g->size) {
+    fprintf(stderr, RED "Invalid genotype fileset." WHITE "\n");
+    exit(EXIT_FAILURE);
+  }
+
+  g->map = mmap(NULL, g->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (g->map == MAP_FAILED) {
+    fprintf(stderr, RED "Failed to map %s for reading." WHITE "\n", c);
+    exit(EXIT_FAILURE);
+  }
+  madvise(g->map, g->size, MADV_SEQUENTIAL);
+
+  unsigned char const *mb = (unsigned char const*) g->map;
+  if (mb[0] != 0x6c || mb[1] != 0x1b || mb[2] != 0x01) {
+    fprintf(stderr, RED "Invalid genotype fileset." WHITE "\n");
+    exit(EXIT_FAILURE);
+  }
+  g->g = &mb[3];
+}
+
+// lets the kernel drop the pages of snps s0 to s1, which are done
+void release_genotype(genotype_t *g, u4_t s0, u4_t s1) {
+  size_t const p = (size_t) sysconf(_SC_PAGESIZE);
+  size_t const b = DIV_UP(3 + s0 * g->v, p) * p;
+  size_t const e = ((3 + s1 * g->v) / p) * p;
+  if (e > b) {
+    madvise((unsigned char*) g->map + b, e - b, MADV_DONTNEED);
+  }
+}
+
+void unmap_genotype(genotype_t *g) {
+  munmap(g->map, g->size);
+  g->map = NULL;
+}
+
+/* read_txt_f4 and read_txt_f8 skip the first s[0] lines and the first
+   s[1] tokens of every line, and keep the tokens that are numbers. n[0]
+   receives the number of lines, n[1] the numbers in the first line kept.
+   the file is counted first, so that the values get one allocation
+*/
+static size_t count_txt(FILE *fp, char *a, u4_t l, u4_t *s, u4_t *n) {
+  n[0] = 0;
+  n[1] = 0;
+
+  size_t e = 0;
+  u4_t i = 0;
+  while (fgets(a, l, fp)) {
+    if (n[0] >= s[0]) {
+
+      char *r;
+      char *g = strtok_r(a, " \t\n", &r);
+
+      u4_t j = 0;
+      u4_t k = 0;
+      while (g != NULL) {
+        char *p;
+
+        strtod(g, &p);
+
+        if (k >= s[1] && *p == '\0') {
+          j++;
+        }
+        k++;
+
+        g = strtok_r(NULL, " \t\n", &r);
+      }
+
+      if (n[1] == 0) {
+        n[1] = j;
+      }
+      e = MAX(e, (size_t) i*n[1] + j);
+
+      i++;
+    }
+
+    n[0]++;
+  }
+
+  rewind(fp);
+  return e;
+}
+
 void read_txt_f4(char *f, u4_t *s, u4_t *n,
     f4_t **e) {
   u4_t l = 1048576;
   char * a = (char*) allocate_u1(l);
 
-  n[0] = 0;
-  n[1] = 0;
-
   FILE *fp = fopen(f, "r");
   if (!fp) {
     fprintf(stderr, RED "Failed to open %s for reading." WHITE "\n", f);
     exit(EXIT_FAILURE);
   }
 
-  *e = allocate_f4(0);
+  *e = allocate_f4(count_txt(fp, a, l, s, n));
 
   u4_t i = 0;
+  u4_t c = 0;
   while (fgets(a, l, fp)) {
-    if (n[0] >= s[0]) {
+    if (c >= s[0]) {
 
-      char *g = strtok(a, " \t\n");
+      char *r;
+      char *g = strtok_r(a, " \t\n", &r);
 
       u4_t j = 0;
       u4_t k = 0;
@@ -171,24 +377,402 @@ void read_txt_f4(char *f, u4_t *s, u4_t *n,
         f4_t q = strtof(g, &p);
 
         if (k >= s[1] && *p == '\0') {
-          allocate_f4(1);
-          (*e)[i*n[1]+j] = q;
+          (*e)[(size_t) i*n[1]+j] = q;
 
           j++;
         }
         k++;
 
-        g = strtok(NULL, " \t\n");
+        g = strtok_r(NULL, " \t\n", &r);
       }
 
-      if (n[1] == 0) {
-        n[1] = j;
+      i++;
+    }
+
+    c++;
+  }
+
+  fclose(fp);
+}
+
+/* the text time series are parsed straight from a mapping of the file. a
+   row is every line that is not blank, except for a first line without
+   numbers, which is a header. tokens that are not numbers are skipped, as
+   in read_txt_f4, and every row must have as many numbers as the first
+*/
+
+static inline u4_t space(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline u4_t digit(char c) {
+  return (unsigned char) (c - '0') < 10;
+}
+
+static char const *mapfile(char *f, size_t *s) {
+  int fd = open(f, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, RED "Failed to open %s for reading." WHITE "\n", f);
+    exit(EXIT_FAILURE);
+  }
+
+  struct stat st;
+  fstat(fd, &st);
+  *s = (size_t) st.st_size;
+
+  char const *a = NULL;
+  if (*s > 0) {
+    a = (char const*) mmap(NULL, *s, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (a == MAP_FAILED) {
+      fprintf(stderr, RED "Failed to map %s." WHITE "\n", f);
+      exit(EXIT_FAILURE);
+    }
+    madvise((void*) a, *s, MADV_WILLNEED);
+  }
+
+  close(fd);
+  return a;
+}
+
+static f4_t const pow10f4[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f,
+  1e7f, 1e8f, 1e9f, 1e10f};
+static f8_t const pow10f8[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+  1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+  1e21, 1e22};
+
+// the value of 8 digits at once, if they are digits
+static inline u4_t eightdigits(char const *p, u8_t *v) {
+  #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    u8_t a;
+    memcpy(&a, p, 8);
+    if ((a & 0xf0f0f0f0f0f0f0f0ULL) != 0x3030303030303030ULL || \
+      ((a + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) != 0x3030303030303030ULL) {
+      return 0;
+    }
+    a -= 0x3030303030303030ULL;
+    a = (a * 10) + (a >> 8);
+    *v = (((a & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32))) + \
+      (((a >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32)))) >> 32;
+    return 1;
+  #else
+    (void) p;
+    (void) v;
+    return 0;
+  #endif
+}
+
+// strtof on a token that is not terminated
+static u4_t slowf4(char const *p, char const *e, f4_t *v) {
+  char b[128];
+  size_t const l = (size_t) (e - p);
+  if (l >= sizeof(b)) {
+    return 0;
+  }
+  memcpy(b, p, l);
+  b[l] = '\0';
+
+  char *q;
+  *v = strtof(b, &q);
+  return *q == '\0' && l > 0;
+}
+
+/* the token [p, e) as a float, and 1 if all of it is a number. up to 19
+   digits are gathered as an integer, and scaled by an exact power of ten,
+   which rounds exactly like strtof. everything else goes to strtof
+*/
+static inline u4_t parsef4(char const *p, char const *e, f4_t *v) {
+  char const *q = p;
+
+  u4_t neg = 0;
+  if (q < e && (*q == '-' || *q == '+')) {
+    neg = (*q == '-');
+    q++;
+  }
+
+  u8_t d = 0;
+  int nd = 0; // significant digits
+  int x = 0; // decimal exponent
+  u4_t any = 0;
+
+  for (u4_t fraction = 0; fraction < 2; fraction++) {
+    if (fraction) {
+      if (q >= e || *q != '.') {
+        break;
+      }
+      q++;
+    }
+    while (q < e) {
+      u8_t w;
+      if (e - q >= 8 && nd + 8 <= 19 && eightdigits(q, &w)) {
+        d = d * 100000000ULL + w;
+        nd += (d > 0) ? 8 : 0;
+        x -= fraction ? 8 : 0;
+        q += 8;
+        any = 1;
+        continue;
       }
+      if (!digit(*q)) {
+        break;
+      }
+      if (nd >= 19) {
+        return slowf4(p, e, v);
+      }
+      d = d * 10 + (u8_t) (*q - '0');
+      nd += (d > 0);
+      x -= fraction;
+      q++;
+      any = 1;
+    }
+  }
 
-      i++;
+  if (!any) {
+    return slowf4(p, e, v); // nan, inf, or not a number
+  }
+
+  if (q < e && (*q == 'e' || *q == 'E')) {
+    q++;
+    int s = 1;
+    if (q < e && (*q == '-' || *q == '+')) {
+      s = (*q == '-') ? -1 : 1;
+      q++;
+    }
+    if (q >= e || !digit(*q)) {
+      return slowf4(p, e, v);
     }
+    int y = 0;
+    while (q < e && digit(*q) && y < 100000) {
+      y = y * 10 + (*q - '0');
+      q++;
+    }
+    x += s * y;
+  }
 
-    n[0]++;
+  if (q != e) {
+    return slowf4(p, e, v);
+  }
+
+  f4_t r;
+  if (d == 0) {
+    r = 0.0f;
+  } else if (d <= (1ULL << 24) && x >= -10 && x <= 10) {
+    r = (x >= 0) ? (f4_t) d * pow10f4[x] : (f4_t) d / pow10f4[-x];
+  } else if (d <= (1ULL << 53) && x >= -22 && x <= 22) {
+    f8_t a = (x >= 0) ? (f8_t) d * pow10f8[x] : (f8_t) d / pow10f8[-x];
+
+    // the double is exact to its last bit, and rounding it again to float
+    // can only go wrong half way between two floats
+    u8_t b;
+    memcpy(&b, &a, sizeof(b));
+    if ((b & 0x1fffffffULL) == 0x10000000ULL || a < (f8_t) FLT_MIN) {
+      return slowf4(p, e, v);
+    }
+    r = (f4_t) a;
+  } else {
+    return slowf4(p, e, v);
+  }
+
+  *v = neg ? -r : r;
+  return 1;
+}
+
+// the end of the line at p, before the newline
+static inline char const *lineend(char const *p, char const *e) {
+  char const *q = (char const*) memchr(p, '\n', (size_t) (e - p));
+  return q ? q : e;
+}
+
+static inline u4_t blank(char const *p, char const *e) {
+  while (p < e && space(*p)) {
+    p++;
+  }
+  return p == e;
+}
+
+// parses the numbers of the line [p, e) into v, which has room for l, and
+// returns how many there are
+static u4_t parseline(char const *p, char const *e, f4_t *v, u4_t l) {
+  u4_t k = 0;
+  while (p < e) {
+    while (p < e && space(*p)) {
+      p++;
+    }
+    char const *t = p;
+    while (t < e && !space(*t)) {
+      t++;
+    }
+    if (t > p) {
+      f4_t y;
+      if (parsef4(p, t, &y)) {
+        if (k < l) {
+          v[k] = y;
+        }
+        k++;
+      }
+    }
+    p = t;
+  }
+  return k;
+}
+
+static u4_t countrows(char const *p, char const *e) {
+  u4_t r = 0;
+  while (p < e) {
+    char const *q = lineend(p, e);
+    r += !blank(p, q);
+    p = q + 1;
+  }
+  return r;
+}
+
+// skips blank lines and a header, and returns where the rows start. n[1]
+// receives the numbers in the first row
+static char const *txtbegin(char const *a, char const *e, u4_t *n) {
+  u4_t header = 0;
+  char const *p = a;
+  n[1] = 0;
+  while (p < e) {
+    char const *q = lineend(p, e);
+    if (!blank(p, q)) {
+      n[1] = parseline(p, q, NULL, 0);
+      if (n[1] > 0 || header) {
+        break;
+      }
+      header = 1;
+    }
+    p = q + 1;
+  }
+  return (p < e) ? p : e;
+}
+
+// the rows and columns read_txt_columns_f4 finds in f, without reading the
+// values
+void read_txt_dim(char *f, u4_t *n) {
+  size_t s;
+  char const *a = mapfile(f, &s);
+
+  n[0] = 0;
+  n[1] = 0;
+  if (s > 0) {
+    char const *p = txtbegin(a, a + s, n);
+    n[0] = countrows(p, a + s);
+    munmap((void*) a, s);
+  }
+}
+
+// bytes of stack that read_txt_columns_f4 needs besides the values
+size_t read_txt_size(u4_t n) {
+  return (size_t) omp_get_max_threads() * 16 * n * sizeof(f4_t) + 2*clb;
+}
+
+/* reads the numbers of f into d as n[1] columns of n[0] rows each, i.e.
+   transposed. the file is split into a chunk of lines per thread, which
+   first count their rows and then parse them. every thread gathers 16 rows
+   before it writes them, so that each column receives a whole cache line
+*/
+void read_txt_columns_f4(char *f, u4_t *n,
+    f4_t **d) {
+  size_t s;
+  char const *a = mapfile(f, &s);
+
+  n[0] = 0;
+  n[1] = 0;
+  *d = allocate_f4(0);
+  if (s == 0) {
+    return;
+  }
+
+  char const *e = a + s;
+  char const *p0 = txtbegin(a, e, n);
+  u4_t const nc = n[1];
+
+  u4_t const nt = (u4_t) omp_get_max_threads();
+  size_t const nb = (size_t) (e - p0);
+
+  char const *b[nt + 1];
+  u4_t r[nt + 1];
+
+  b[0] = p0;
+  for (u4_t t = 1; t < nt; t++) { // line-aligned
+    char const *q = p0 + nb * t / nt;
+    if (q < b[t-1]) {
+      q = b[t-1];
+    }
+    if (q > p0 && q < e && q[-1] != '\n') {
+      q = lineend(q, e);
+      q = (q < e) ? q + 1 : e;
+    }
+    b[t] = q;
+  }
+  b[nt] = e;
+
+  #pragma omp parallel for num_threads(nt)
+  for (u4_t t = 0; t < nt; t++) {
+    r[t+1] = countrows(b[t], b[t+1]);
+  }
+  r[0] = 0;
+  for (u4_t t = 0; t < nt; t++) {
+    r[t+1] += r[t];
+  }
+
+  u4_t const m = r[nt];
+  n[0] = m;
+
+  clalign_stack();
+  *d = allocate_f4((size_t) nc*m);
+  f4_t *x = *d;
+
+  u4_t const tl = 16;
+  clalign_stack();
+  f4_t *tile = allocate_f4((size_t) nt*tl*nc);
+
+  u4_t bad = 0;
+  u4_t badrow = 0;
+  u4_t badn = 0;
+
+  #pragma omp parallel for num_threads(nt)
+  for (u4_t t = 0; t < nt; t++) {
+    f4_t *v = &tile[(size_t) t*tl*nc];
+
+    u4_t i = r[t];
+    u4_t k = 0;
+    char const *p = b[t];
+    while (p < b[t+1] || k > 0) {
+      if (p < b[t+1]) {
+        char const *q = lineend(p, b[t+1]);
+        if (!blank(p, q)) {
+          u4_t c = parseline(p, q, &v[(size_t) k*nc], nc);
+          if (c != nc) {
+            #pragma omp critical(readtxt)
+            if (!bad || i + k < badrow) {
+              bad = 1;
+              badrow = i + k;
+              badn = c;
+            }
+          }
+          k++;
+        }
+        p = q + 1;
+      }
+
+      if (k == tl || (k > 0 && p >= b[t+1])) {
+        for (u4_t jj = 0; jj < nc; jj++) {
+          for (u4_t kk = 0; kk < k; kk++) {
+            x[(size_t) jj*m + i + kk] = v[(size_t) kk*nc + jj];
+          }
+        }
+        i += k;
+        k = 0;
+      }
+    }
+  }
+
+  free_f4((size_t) nt*tl*nc);
+
+  munmap((void*) a, s);
+
+  if (bad) {
+    fprintf(stderr, RED "Error: row %u of %s has %u numbers, the first has %u." WHITE "\n", badrow + 1, f, badn, nc);
+    exit(EXIT_FAILURE);
   }
 }
 
@@ -197,22 +781,21 @@ void read_txt_f8(char *f, u4_t *s, u4_t *n,
   u4_t l = 1048576;
   char * a = (char*) allocate_u1(l);
 
-  n[0] = 0;
-  n[1] = 0;
-
   FILE *fp = fopen(f, "r");
   if (!fp) {
     fprintf(stderr, RED "Failed to open %s for reading." WHITE "\n", f);
     exit(EXIT_FAILURE);
   }
 
-  *e = allocate_f8(0);
+  *e = allocate_f8(count_txt(fp, a, l, s, n));
 
   u4_t i = 0;
+  u4_t c = 0;
   while (fgets(a, l, fp)) {
-    if (n[0] >= s[0]) {
+    if (c >= s[0]) {
 
-      char *g = strtok(a, " \t\n");
+      char *r;
+      char *g = strtok_r(a, " \t\n", &r);
 
       u4_t j = 0;
       u4_t k = 0;
@@ -222,56 +805,178 @@ void read_txt_f8(char *f, u4_t *s, u4_t *n,
         double q = strtod(g, &p);
 
         if (k >= s[1] && *p == '\0') {
-          allocate_f8(1);
-          (*e)[i*n[1]+j] = q;
+          (*e)[(size_t) i*n[1]+j] = q;
 
           j++;
         }
         k++;
 
-        g = strtok(NULL, " \t\n");
-      }
-
-      if (n[1] == 0) {
-        n[1] = j;
+        g = strtok_r(NULL, " \t\n", &r);
       }
 
       i++;
     }
 
-    n[0]++;
+    c++;
+  }
+
+  fclose(fp);
+}
+
+static void convertf8(double const *d, f4_t *r, size_t n) {
+  #pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < n; i++) {
+    r[i] = (f4_t) d[i];
   }
 }
 
 void read_binaryf8_f4(char* f, u4_t *n,
   f4_t **r) {
+  size_t s;
+  char const *a = mapfile(f, &s);
+  if (s < *n * sizeof(double)) {
+    fprintf(stderr, RED "Failed to read %s." WHITE "\n", f);
+    exit(EXIT_FAILURE);
+  }
 
-  int fd = open(f, O_RDONLY, 0);
-  if (fd == -1) {
-    fprintf(stderr, RED "Failed to open %s for reading." WHITE "\n", f);
+  *r = allocate_f4(*n);
+  convertf8((double const*) a, *r, *n);
+
+  munmap((void*) a, s);
+}
+
+/* the values of a .npy file start after its header, whose length is 2
+   bytes in version 1 and 4 bytes after that. only little endian f4 or f8
+   arrays in c order are read. returns the offset of the values and sets
+   the shape, d dimensions at most
+*/
+static size_t npyshape(char *f, char const *a, size_t s,
+  u4_t *n, u4_t *d, u4_t *f8) {
+  size_t b = 0; // where the header text begins
+  size_t h = s + 1;
+  if (s >= 10 && memcmp(a, "\x93NUMPY\x01", 7) == 0) {
+    b = 10;
+    h = b + (size_t) (unsigned char) a[8] + ((size_t) (unsigned char) a[9] << 8);
+  } else if (s >= 12 && memcmp(a, "\x93NUMPY", 6) == 0) {
+    b = 12;
+    h = b + (size_t) (unsigned char) a[8] + ((size_t) (unsigned char) a[9] << 8) + \
+      ((size_t) (unsigned char) a[10] << 16) + ((size_t) (unsigned char) a[11] << 24);
+  }
+
+  char c[4096];
+  size_t const l = (h <= s && h - b < sizeof(c)) ? h - b : 0;
+  memcpy(c, a + b, l);
+  c[l] = '\0';
+
+  char *e = strstr(c, "'descr':");
+  char *o = strstr(c, "'fortran_order':");
+  char *p = strstr(c, "'shape':");
+  if (!e || !o || !p || strncmp(o + 16, " True", 5) == 0) {
+    fprintf(stderr, RED "Error: %s is not a .npy file of f4 or f8 values in c order." WHITE "\n", f);
     exit(EXIT_FAILURE);
   }
 
-  size_t fs = *n * sizeof(double);
-  void *fmap = mmap(NULL, fs, PROT_READ, MAP_PRIVATE, fd, 0);
-  if (fmap == MAP_FAILED) {
-    fprintf(stderr, RED "Failed map memory for %s for reading." WHITE "\n", f);
+  if (strncmp(e + 8, " '<f4'", 6) == 0) {
+    *f8 = 0;
+  } else if (strncmp(e + 8, " '<f8'", 6) == 0) {
+    *f8 = 1;
+  } else {
+    fprintf(stderr, RED "Error: %s is not a .npy file of f4 or f8 values in c order." WHITE "\n", f);
     exit(EXIT_FAILURE);
   }
 
-  double *fmapd = (double*) fmap;
+  u4_t const dm = *d;
+  *d = 0;
+  p = strchr(p, '(');
+  while (p && *d < dm) {
+    char *q;
+    unsigned long v = strtoul(p + 1, &q, 10);
+    if (q == p + 1) {
+      break;
+    }
+    n[(*d)++] = (u4_t) v;
+    p = strchr(q, ',');
+  }
 
-  *r = allocate_f4(*n);
-  for (u4_t i = 0; i < *n; ++i) {
-    (*r)[i] = (f4_t) fmapd[i];
+  return h;
+}
+
+/* connectivity matrices, n[1] of n[0] x n[0] each. .npy files have the
+   shape (n, n) or (k, n, n). other files are raw, f4 if the name ends in
+   .f4 and f8 otherwise as for read_binaryf8_f4, and are taken to be one
+   square matrix unless n[0] is given. f8 is set for f8 values. returns the
+   offset of the values in the file
+*/
+static size_t matricesshape(char *f, char const *a, size_t s,
+  u4_t *n, u4_t *f8) {
+  char const *e = strrchr(f, '.');
+
+  size_t o = 0;
+  if (e && strcmp(e, ".npy") == 0) {
+    u4_t d[3];
+    u4_t nd = 3;
+    o = npyshape(f, a, s, &d[0], &nd, f8);
+    if (nd == 2 && d[0] == d[1]) {
+      n[0] = d[0];
+      n[1] = 1;
+    } else if (nd == 3 && d[1] == d[2]) {
+      n[0] = d[1];
+      n[1] = d[0];
+    } else {
+      n[0] = 0;
+    }
+  } else {
+    *f8 = !(e && strcmp(e, ".f4") == 0);
+    size_t const b = *f8 ? sizeof(double) : sizeof(f4_t);
+    if (n[0] == 0) {
+      n[0] = (u4_t) sqrt((f8_t) (s / b));
+    }
+    n[1] = (n[0] > 0) ? (u4_t) (s / b / ((size_t) n[0]*n[0])) : 0;
   }
 
-  int rc = munmap(fmap, fs);
-  if (rc != 0) {
-    fprintf(stderr, RED "Failed unmap memory for %s after reading." WHITE "\n", f);
+  size_t const v = (size_t) n[0]*n[0]*n[1] * (*f8 ? sizeof(double) : sizeof(f4_t));
+  if (n[0] < 2 || n[1] == 0 || o + v != s) {
+    fprintf(stderr, RED "Error: %s does not hold square matrices." WHITE "\n", f);
     exit(EXIT_FAILURE);
   }
-  close(fd);
+  return o;
+}
+
+// the matrices that read_matrices_f4 finds in f, without reading them
+void read_matrices_dim(char *f, u4_t *n, u4_t *f8) {
+  size_t s;
+  char const *a = mapfile(f, &s);
+  matricesshape(f, a, s, n, f8);
+  if (a) {
+    munmap((void*) a, s);
+  }
+}
+
+/* maps the matrices of f, see matricesshape. f4 values are used in place,
+   so x points into the mapping of s bytes that is returned, which the
+   caller unmaps. f8 values are converted onto the stack instead, and NULL
+   is returned
+*/
+void *read_matrices_f4(char *f, u4_t *n, f4_t **x, size_t *s) {
+  char const *a = mapfile(f, s);
+
+  u4_t f8;
+  size_t const o = matricesshape(f, a, *s, n, &f8);
+  size_t const v = (size_t) n[0]*n[0]*n[1];
+
+  if (!f8 && o % sizeof(f4_t) == 0) {
+    *x = (f4_t*) (a + o);
+    return (void*) a;
+  }
+
+  *x = allocate_f4(v);
+  if (f8) {
+    convertf8((double const*) (a + o), *x, v);
+  } else {
+    memcpy(*x, a + o, v * sizeof(f4_t));
+  }
+  munmap((void*) a, *s);
+  return NULL;
 }
 
 void read_binaryf8_f8(char* f, u4_t *n,
@@ -23,17 +23,45 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
 void write_txt_f4(char *f, u4_t *n, f4_t *d);
 void write_txt_f8(char *f, u4_t *n, double *d);
 
 void write_ntxt_f4(char *f, u4_t *n, f4_t *d, char **cn, char **rn, u4_t *nn);
 
+void write_npy_block_f4(char *f, u4_t const *n, u4_t d, size_t o, f4_t const *e, size_t s);
+void write_npy_header_f4(char *f, u4_t const *n, u4_t d);
+void *map_npy_f4(char *f, u4_t const *n, u4_t d, f4_t **e, size_t *s);
+
 void read_genotype(char *b, u4_t *n, u4_t **g);
 
+// a plink fileset, see map_genotype
+typedef struct {
+  unsigned char const *g; // snp-major, v bytes of 4 subjects each per snp
+  u4_t n; // subjects
+  u4_t ns; // snps
+  size_t v;
+  void *map;
+  size_t size;
+} genotype_t;
+
+void map_genotype(char *b, genotype_t *g);
+void release_genotype(genotype_t *g, u4_t s0, u4_t s1);
+void unmap_genotype(genotype_t *g);
+
 void read_txt_f4(char *f, u4_t *s, u4_t *n, f4_t **d);
 void read_txt_f8(char *f, u4_t *s, u4_t *n, double **d);
+void read_txt_dim(char *f, u4_t *n);
+void read_txt_columns_f4(char *f, u4_t *n, f4_t **d);
+size_t read_txt_size(u4_t n);
 
 void read_binaryf8_f4(char* f, u4_t *n, f4_t **r);
 void read_binaryf8_f8(char* f, u4_t *n, double **r);
 
+void read_matrices_dim(char *f, u4_t *n, u4_t *f8);
+void *read_matrices_f4(char *f, u4_t *n, f4_t **x, size_t *s);
+
 #endif
@@ -15,20 +15,60 @@
 
 #include "m_common_io_neuroimaging.h"
 
-void read_nii_f4(char* f, u4_t *n,
-    u4_t **z, f4_t **e) {
-  nifti_image *m = nifti_image_read(f, 1);
-  if (!m) {
+/* the image is streamed a block of volumes at a time, twice. the first
+   pass finds the voxels with signal, and the second copies the block into
+   the time series of these voxels. both go through the voxels in the order
+   of the file, in tiles, so that the block is read sequentially and every
+   time series receives a run of time points at once
+*/
+
+static size_t const niiblocksize = 64 * 1024 * 1024; // bytes, about
+
+static u4_t niiblock(u4_t const *d) {
+  size_t const v = (size_t) d[0]*d[1]*d[2] * sizeof(f4_t);
+  size_t b = niiblocksize / v;
+  if (b < 16) {
+    b = 16; // a cache line of every time series
+  }
+  return (u4_t) ((b < d[3]) ? b : d[3]);
+}
+
+// bytes of stack that read_nii_f4 needs besides the time series and mask
+size_t read_nii_size(u4_t const *d) {
+  return ((size_t) niiblock(d) + 1) * d[0]*d[1]*d[2] * sizeof(f4_t) + 3*clb;
+}
+
+static FSLIO *opennii(char *f, u4_t *d) {
+  FSLIO *m = FslOpen(f, "rb");
+  if (!m || !m->niftiptr) {
     fprintf(stderr, RED "Failed to open %s for reading." WHITE "\n", f);
     exit(EXIT_FAILURE);
   }
 
-  const u4_t d[4] = {
-     m->nx,
-     m->ny,
-     m->nz,
-     m->nt
-  };
+  d[0] = m->niftiptr->nx;
+  d[1] = m->niftiptr->ny;
+  d[2] = m->niftiptr->nz;
+  d[3] = m->niftiptr->nt;
+
+  if (m->niftiptr->datatype != NIFTI_TYPE_FLOAT32) {
+    fprintf(stderr, RED "Nifti data type needs to be float32." WHITE "\n");
+    exit(EXIT_FAILURE);
+  }
+
+  return m;
+}
+
+static void readvolumes(FSLIO *m, char *f, f4_t *h, u4_t b) {
+  if (FslReadVolumes(m, h, b) != b) {
+    fprintf(stderr, RED "Failed to read %s." WHITE "\n", f);
+    exit(EXIT_FAILURE);
+  }
+}
+
+void read_nii_f4(char* f, u4_t *n,
+    u4_t **z, f4_t **e) {
+  u4_t d[4];
+  FSLIO *m = opennii(f, &d[0]);
 
   if (debug) {
     printf("nifti size %u %u %u %u\n", d[0], d[1], d[2], d[3]);
@@ -36,44 +76,468 @@ void read_nii_f4(char* f, u4_t *n,
 
   n[0] = d[3];
 
-  if (m->datatype != NIFTI_TYPE_FLOAT32) {
-    fprintf(stderr, RED "Nifti data type needs to be float32." WHITE "\n");
-    exit(EXIT_FAILURE);
-  }
-  size_t p = d[0] * d[1] * d[2];
+  size_t const p = (size_t) d[0]*d[1]*d[2];
+  u4_t const b = niiblock(d);
+  u4_t const tl = 64; // voxels
+
   *z = allocate_u4(p);
 
-  *e = allocate_f4(0);
+  // the sum of absolute values of every voxel, in the order of the volumes
 
-  f4_t *h = (f4_t*) m->data;
+  clalign_stack();
+  f4_t *s = allocate_f4(p);
+  memset(s, 0, p * sizeof(f4_t));
+
+  clalign_stack();
+  f4_t *h = allocate_f4((size_t) b*p);
+
+  for (u4_t t0 = 0; t0 < d[3]; t0 += b) {
+    u4_t const nb = (t0 + b < d[3]) ? b : d[3] - t0;
+    readvolumes(m, f, h, nb);
+
+    #pragma omp parallel for schedule(static)
+    for (size_t v0 = 0; v0 < p; v0 += tl) {
+      size_t const v1 = (v0 + tl < p) ? v0 + tl : p;
+      for (u4_t t = 0; t < nb; t++) {
+        for (size_t v = v0; v < v1; v++) {
+          s[v] += fabsf(h[(size_t) t*p+v]);
+        }
+      }
+    }
+  }
+  FslClose(m);
+
+  free_f4((size_t) b*p);
+
+  // the voxels are numbered with x slowest and z fastest, and s becomes the
+  // number of every voxel, or -1
+
+  u4_t *r = (u4_t*) s;
 
   n[1] = 0;
   for (u4_t i = 0; i < d[0]; ++i) {
     for (u4_t j = 0; j < d[1]; ++j) {
       for (u4_t k = 0; k < d[2]; ++k) {
+        u4_t const v = (k*d[1]+j)*d[0]+i;
+        if (s[v] > 0.0f) {
+          (*z)[n[1]++] = v;
+        }
+      }
+    }
+  }
+  for (size_t v = 0; v < p; v++) {
+    r[v] = (u4_t) -1;
+  }
+  for (u4_t q = 0; q < n[1]; q++) {
+    r[(*z)[q]] = q;
+  }
 
-        f4_t s = 0.0f;
-        for (u4_t t = 0; t < d[3]; ++t) {
-          f4_t u = h[((t*d[2]+k)*d[1]+j)*d[0]+i];
-          s += fabsf(u);
+  u4_t const nt = d[3];
+
+  clalign_stack();
+  *e = allocate_f4((size_t) n[1]*nt);
+  f4_t *x = *e;
+
+  clalign_stack();
+  h = allocate_f4((size_t) b*p);
+
+  m = opennii(f, &d[0]);
+  for (u4_t t0 = 0; t0 < nt; t0 += b) {
+    u4_t const nb = (t0 + b < nt) ? b : nt - t0;
+    readvolumes(m, f, h, nb);
+
+    #pragma omp parallel for schedule(static)
+    for (size_t v0 = 0; v0 < p; v0 += tl) {
+      size_t const v1 = (v0 + tl < p) ? v0 + tl : p;
+      for (u4_t t = 0; t < nb; t++) {
+        for (size_t v = v0; v < v1; v++) {
+          if (r[v] != (u4_t) -1) {
+            x[(size_t) r[v]*nt + t0+t] = h[(size_t) t*p+v];
+          }
+        }
+      }
+    }
+
+    showprogress(t0 / b, DIV_UP(nt, b));
+  }
+  FslClose(m);
+
+  free_f4((size_t) b*p);
+}
+
+/* an atlas is a volume of labels in the space of the image, where 0 is the
+   background. every label becomes a node, in the order of the labels. its
+   time series is the mean of its voxels, or with eig their first
+   eigenvariate, the time course of their first principal component scaled
+   to its variance per voxel and signed like their sum. both come from a
+   single pass over the volumes
+*/
+
+static nifti_image *openatlas(char *a, u4_t const *d) {
+  nifti_image *m = nifti_image_read(a, 1);
+  if (!m || !m->data) {
+    fprintf(stderr, RED "Failed to open %s for reading." WHITE "\n", a);
+    exit(EXIT_FAILURE);
+  }
+
+  if (d && ((u4_t) m->nx != d[0] || (u4_t) m->ny != d[1] || (u4_t) m->nz != d[2])) {
+    fprintf(stderr, RED "Error: the atlas %s does not match the image." WHITE "\n", a);
+    exit(EXIT_FAILURE);
+  }
+
+  return m;
+}
+
+// the label of voxel v in the first volume of the atlas
+static u4_t atlaslabel(nifti_image *m, char *a, size_t v) {
+  f8_t l;
+  switch (m->datatype) {
+    case NIFTI_TYPE_UINT8:
+      l = ((uint8_t*) m->data)[v];
+      break;
+    case NIFTI_TYPE_INT16:
+      l = ((int16_t*) m->data)[v];
+      break;
+    case NIFTI_TYPE_UINT16:
+      l = ((uint16_t*) m->data)[v];
+      break;
+    case NIFTI_TYPE_INT32:
+      l = ((int32_t*) m->data)[v];
+      break;
+    case NIFTI_TYPE_FLOAT32:
+      l = ((f4_t*) m->data)[v];
+      break;
+    case NIFTI_TYPE_FLOAT64:
+      l = ((f8_t*) m->data)[v];
+      break;
+    default:
+      fprintf(stderr, RED "Error: the atlas %s needs to be of an integer or float data type." WHITE "\n", a);
+      exit(EXIT_FAILURE);
+  }
+
+  if (!(l >= 0.0 && l < 4294967295.0) || l != floor(l)) {
+    fprintf(stderr, RED "Error: the labels of the atlas %s need to be non-negative integers." WHITE "\n", a);
+    exit(EXIT_FAILURE);
+  }
+
+  return (u4_t) l;
+}
+
+static int comparelabel(void const *a, void const *b) {
+  u4_t const x = *(u4_t const*) a;
+  u4_t const y = *(u4_t const*) b;
+  return (x > y) - (x < y);
+}
+
+// the labels of the atlas in order, into l if not NULL. returns their number and sets nv to the labelled voxels
+static u4_t atlaslabels(nifti_image *m, char *a, u4_t *l, size_t *nv) {
+  size_t const p = (size_t) m->nx*m->ny*m->nz;
+
+  u4_t *b = (u4_t*) malloc(p * sizeof(u4_t));
+  if (!b) {
+    fprintf(stderr, RED "Error: out of memory reading the atlas %s." WHITE "\n", a);
+    exit(EXIT_FAILURE);
+  }
 
-          (*e)[n[1]*n[0]+t] = u;
+  size_t k = 0;
+  for (size_t v = 0; v < p; v++) {
+    u4_t const q = atlaslabel(m, a, v);
+    if (q != 0) {
+      b[k++] = q;
+    }
+  }
+  qsort(b, k, sizeof(u4_t), comparelabel);
+
+  u4_t nl = 0;
+  for (size_t i = 0; i < k; i++) {
+    if (i == 0 || b[i] != b[i-1]) {
+      if (l) {
+        l[nl] = b[i];
+      }
+      nl++;
+    }
+  }
+  free(b);
+
+  *nv = k;
+  return nl;
+}
+
+// the number of labels of the atlas a, and of the voxels that have one
+void read_nii_atlas_dim(char *a, u4_t *nn) {
+  nifti_image *m = openatlas(a, NULL);
+
+  size_t nv;
+  nn[0] = atlaslabels(m, a, NULL, &nv);
+  nn[1] = (u4_t) nv;
+
+  nifti_image_free(m);
+}
+
+// bytes of stack that read_nii_atlas_f4 needs besides the labels and time series
+size_t read_nii_atlas_size(u4_t const *d, u4_t const *nn, u4_t eig) {
+  size_t const p = (size_t) d[0]*d[1]*d[2];
+  size_t const nth = (size_t) omp_get_max_threads();
+
+  size_t s = (p + nn[0] + 1) * sizeof(u4_t);
+  if (eig) {
+    s += (size_t) nn[1]*d[3] * sizeof(f4_t) + nth * 2*d[3] * sizeof(f8_t);
+  } else {
+    s += nth * nn[0] * sizeof(f8_t);
+  }
+  return s + (size_t) niiblock(d) * p * sizeof(f4_t) + 4*clb;
+}
+
+/* the first eigenvariate of the k voxels in y, m time points each, into e.
+   y is demeaned in place. u is 2m of workspace. the power iteration on the
+   covariance of the time points starts from the mean of the voxels, and
+   stops when u moves less than 1e-6, or after 1024 steps when the first
+   two components are too close to tell apart
+*/
+static void eigenvariate(f4_t *y, u4_t k, u4_t m, f8_t *u, f4_t *e) {
+  f8_t *v = &u[m];
+
+  memset(u, 0, m * sizeof(f8_t));
+  for (u4_t a = 0; a < k; a++) {
+    f4_t *ya = &y[(size_t) a*m];
+    f8_t q = 0.0;
+    for (u4_t t = 0; t < m; t++) {
+      q += ya[t];
+    }
+    q /= (f8_t) m;
+    for (u4_t t = 0; t < m; t++) {
+      ya[t] -= (f4_t) q;
+      u[t] += ya[t];
+    }
+  }
+
+  f8_t s1 = 0.0;
+  f8_t g = 0.0;
+  for (u4_t it = 0; ; it++) {
+    f8_t nu = 0.0;
+    for (u4_t t = 0; t < m; t++) {
+      nu += u[t]*u[t];
+    }
+    if (nu == 0.0 && it == 0 && k > 0) { // the voxels cancel out
+      for (u4_t t = 0; t < m; t++) {
+        u[t] = y[t];
+        nu += u[t]*u[t];
+      }
+    }
+    if (nu == 0.0) {
+      memset(e, 0, m * sizeof(f4_t));
+      return;
+    }
+    nu = 1.0 / sqrt(nu);
+    for (u4_t t = 0; t < m; t++) {
+      u[t] *= nu;
+    }
+
+    // v is the covariance times u, s1 the rayleigh quotient and g the sum of the voxel weights
+    memset(v, 0, m * sizeof(f8_t));
+    s1 = 0.0;
+    g = 0.0;
+    for (u4_t a = 0; a < k; a++) {
+      f4_t const *ya = &y[(size_t) a*m];
+      f8_t w = 0.0;
+      for (u4_t t = 0; t < m; t++) {
+        w += ya[t]*u[t];
+      }
+      for (u4_t t = 0; t < m; t++) {
+        v[t] += w*ya[t];
+      }
+      s1 += w*w;
+      g += w;
+    }
+
+    f8_t nv = 0.0;
+    for (u4_t t = 0; t < m; t++) {
+      nv += v[t]*v[t];
+    }
+    nv = (nv > 0.0) ? 1.0 / sqrt(nv) : 0.0;
+    f8_t du = 0.0;
+    for (u4_t t = 0; t < m; t++) {
+      du += (v[t]*nv - u[t]) * (v[t]*nv - u[t]);
+    }
+
+    if (du < 1e-12 || it == 1023) {
+      break;
+    }
+    memcpy(u, v, m * sizeof(f8_t));
+  }
+
+  f8_t const c = ((g < 0.0) ? -1.0 : 1.0) * sqrt(s1 / k);
+  for (u4_t t = 0; t < m; t++) {
+    e[t] = (f4_t) (c * u[t]);
+  }
+}
+
+void read_nii_atlas_f4(char *f, char *a, u4_t eig, u4_t *n,
+    u4_t **l, f4_t **e) {
+  u4_t d[4];
+  FSLIO *m = opennii(f, &d[0]);
+  nifti_image *am = openatlas(a, &d[0]);
+
+  if (debug) {
+    printf("nifti size %u %u %u %u\n", d[0], d[1], d[2], d[3]);
+  }
+
+  size_t const p = (size_t) d[0]*d[1]*d[2];
+  u4_t const nt = d[3];
+  u4_t const b = niiblock(d);
+  u4_t const tl = 64; // voxels
+  u4_t const nth = (u4_t) omp_get_max_threads();
+
+  size_t nv;
+  u4_t const nl = atlaslabels(am, a, NULL, &nv);
+
+  n[0] = nt;
+  n[1] = nl;
+
+  *l = allocate_u4(nl);
+  atlaslabels(am, a, *l, &nv);
+
+  clalign_stack();
+  *e = allocate_f4((size_t) nl*nt);
+  f4_t *x = *e;
+
+  // r is the node of every voxel, or -1, and c the voxels of every node
+
+  stackmark_t k = mark_stack();
+
+  u4_t *r = allocate_u4(p);
+  u4_t *c = allocate_u4(nl + 1);
+  memset(c, 0, (nl + 1) * sizeof(u4_t));
+
+  for (size_t v = 0; v < p; v++) {
+    u4_t const q = atlaslabel(am, a, v);
+    r[v] = (u4_t) -1;
+    if (q != 0) {
+      u4_t lo = 0;
+      u4_t hi = nl;
+      while (lo < hi) {
+        u4_t const mid = lo + (hi - lo) / 2;
+        if ((*l)[mid] < q) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
         }
+      }
+      r[v] = lo;
+      c[lo]++;
+    }
+  }
+  nifti_image_free(am);
+
+  if (!eig) {
+    clalign_stack();
+    f8_t *s = allocate_f8((size_t) nth*nl); // sums of every thread
 
-        if (s > 0.0f) {
-          (*z)[n[1]] = (k*d[1]+j)*d[0]+i;
+    clalign_stack();
+    f4_t *h = allocate_f4((size_t) b*p);
+
+    for (u4_t t0 = 0; t0 < nt; t0 += b) {
+      u4_t const nb = (t0 + b < nt) ? b : nt - t0;
+      readvolumes(m, f, h, nb);
+
+      #pragma omp parallel for schedule(static) num_threads(nth)
+      for (u4_t t = 0; t < nb; t++) {
+        f8_t *q = &s[(size_t) omp_get_thread_num()*nl];
+        memset(q, 0, nl * sizeof(f8_t));
+
+        f4_t const *ht = &h[(size_t) t*p];
+        for (size_t v = 0; v < p; v++) {
+          if (r[v] != (u4_t) -1) {
+            q[r[v]] += ht[v];
+          }
+        }
+        for (u4_t i = 0; i < nl; i++) {
+          x[(size_t) i*nt + t0+t] = (f4_t) (q[i] / c[i]);
+        }
+      }
 
-          n[1]++;
-          allocate_f4(n[0]);
+      showprogress(t0 / b, DIV_UP(nt, b));
+    }
+    FslClose(m);
+
+    free_f4((size_t) b*p);
+  } else {
+    // the voxels of every node are gathered into y, one after the other,
+    // and c becomes the offset of every node
+
+    u4_t o = 0;
+    for (u4_t i = 0; i < nl; i++) {
+      u4_t const ci = c[i];
+      c[i] = o;
+      o += ci;
+    }
+    c[nl] = o;
+    for (size_t v = 0; v < p; v++) {
+      if (r[v] != (u4_t) -1) {
+        r[v] = c[r[v]]++;
+      }
+    }
+    for (u4_t i = nl; i > 0; i--) {
+      c[i] = c[i-1];
+    }
+    c[0] = 0;
+
+    clalign_stack();
+    f4_t *y = allocate_f4(nv*nt);
+
+    clalign_stack();
+    f4_t *h = allocate_f4((size_t) b*p);
+
+    for (u4_t t0 = 0; t0 < nt; t0 += b) {
+      u4_t const nb = (t0 + b < nt) ? b : nt - t0;
+      readvolumes(m, f, h, nb);
+
+      #pragma omp parallel for schedule(static) num_threads(nth)
+      for (size_t v0 = 0; v0 < p; v0 += tl) {
+        size_t const v1 = (v0 + tl < p) ? v0 + tl : p;
+        for (u4_t t = 0; t < nb; t++) {
+          for (size_t v = v0; v < v1; v++) {
+            if (r[v] != (u4_t) -1) {
+              y[(size_t) r[v]*nt + t0+t] = h[(size_t) t*p+v];
+            }
+          }
         }
       }
+
+      showprogress(t0 / b, DIV_UP(nt, b));
+    }
+    FslClose(m);
+
+    free_f4((size_t) b*p);
+
+    clalign_stack();
+    f8_t *w = allocate_f8((size_t) nth*2*nt);
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nth)
+    for (u4_t i = 0; i < nl; i++) {
+      eigenvariate(&y[(size_t) c[i]*nt], c[i+1] - c[i], nt,
+        &w[(size_t) omp_get_thread_num()*2*nt], &x[(size_t) i*nt]);
     }
 
-    showprogress(i, d[0]);
   }
 
-  free(m->data);
-  free(m);
+  release_stack(k);
+}
+
+// nx, ny, nz and nt from the header of f
+void read_nii_dim(char* f, u4_t *d) {
+  nifti_image *m = nifti_image_read(f, 0);
+  if (!m) {
+    fprintf(stderr, RED "Failed to open %s for reading." WHITE "\n", f);
+    exit(EXIT_FAILURE);
+  }
+
+  d[0] = m->nx;
+  d[1] = m->ny;
+  d[2] = m->nz;
+  d[3] = m->nt;
+
+  nifti_image_free(m);
 }
 
 void read_nii_f8(char* f, u4_t *n,
@@ -101,36 +565,35 @@ void read_nii_f8(char* f, u4_t *n,
     fprintf(stderr, RED "Nifti data type needs to be float32." WHITE "\n");
     exit(EXIT_FAILURE);
   }
-  size_t p = d[0] * d[1] * d[2];
+  size_t p = (size_t) d[0] * d[1] * d[2];
   *z = allocate_u4(p);
 
-  *e = allocate_f8(0);
-
   f4_t *h = (f4_t*) m->data;
 
+  // voxels with signal are counted first, so the series get one allocation
   n[1] = 0;
   for (u4_t i = 0; i < d[0]; ++i) {
     for (u4_t j = 0; j < d[1]; ++j) {
       for (u4_t k = 0; k < d[2]; ++k) {
-
-        double s = 0.0f;
+        double s = 0.0;
         for (u4_t t = 0; t < d[3]; ++t) {
-          double u = (double) h[((t*d[2]+k)*d[1]+j)*d[0]+i];
-          s += fabs(u);
-
-          (*e)[n[1]*n[0]+t] = u;
+          s += fabs((double) h[(((size_t) t*d[2]+k)*d[1]+j)*d[0]+i]);
         }
-
-        if (s > 0.0f) {
-          (*z)[n[1]] = (k*d[1]+j)*d[0]+i;
-
-          n[1]++;
-          allocate_f8(n[0]);
+        if (s > 0.0) {
+          (*z)[n[1]++] = (k*d[1]+j)*d[0]+i;
         }
       }
     }
+  }
+
+  *e = allocate_f8((size_t) n[1]*n[0]);
 
-    showprogress(i, d[0]);
+  for (u4_t v = 0; v < n[1]; ++v) {
+    for (u4_t t = 0; t < d[3]; ++t) {
+      (*e)[(size_t) v*n[0]+t] = (double) h[(size_t) t*p + (*z)[v]];
+    }
+
+    showprogress(v, n[1]);
   }
 
   free(m->data);
@@ -179,6 +642,8 @@ void write_nii_f4(char *f, char* lf, u4_t *n,
 
   FslClose(m);
   FslClose(mw);
+
+  free_f4(p);
 }
 
 void write_nii_f8(char *f, char* lf, u4_t *n,
@@ -20,8 +20,17 @@
 
 #include "fslio/fslio.h"
 
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
 void read_nii_f4(char* f, u4_t *n, u4_t **z, f4_t **e);
 void read_nii_f8(char* f, u4_t *n, u4_t **z, double **e);
+void read_nii_dim(char* f, u4_t *d);
+size_t read_nii_size(u4_t const *d);
+void read_nii_atlas_f4(char *f, char *a, u4_t eig, u4_t *n, u4_t **l, f4_t **e);
+void read_nii_atlas_dim(char *a, u4_t *nn);
+size_t read_nii_atlas_size(u4_t const *d, u4_t const *nn, u4_t eig);
 void write_nii_f4(char *f, char* lf, u4_t *n, u4_t *z, f4_t *e);
 void write_nii_f8(char *f, char* lf, u4_t *n, u4_t *z, double *e);
 
@@ -13,29 +13,227 @@
 // You should have received a copy of the GNU Lesser General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#define _GNU_SOURCE // sched_getcpu
+
 #include "m_common_memory.h"
 
 unsigned char* stack_begin;
 unsigned char* stack_end;
 
+/* when a stack is full, another chunk is mapped and the stack continues
+   there, so earlier allocations never move. the header of every chunk
+   remembers where the stack was before, which free_* and release_stack
+   return to. the last chunk that was given back is kept for reuse
+*/
+struct chunk {
+  chunk_t *prev;
+  unsigned char *begin; // the stack before this chunk
+  unsigned char *end;
+  size_t size;
+  size_t below; // bytes in use before this chunk
+};
+
+typedef struct {
+  int team;
+  unsigned char *base;
+  size_t size;
+  size_t high; // high-water mark in bytes, including chunks
+  u4_t chunks;
+} stackinfo_t;
+
+static chunk_t *stack_chunk;
+static stackinfo_t *stack_info;
+static chunk_t *stack_spare;
+#pragma omp threadprivate(stack_chunk, stack_info, stack_spare)
+
+static size_t const chunksize = 64 * 1024 * 1024; // at least
+
+static stackinfo_t *stackinfos[1024];
+static u4_t nstackinfos;
+
 /* this is based on bigstack as implemented by
    https://github.com/chrchang/plink-ng, plink2/pgenlib_internal.h
    but much more basic
 */
 
-void allocate_stack() {
-  u4_t s;
-
+// the size in MB set by MASSIVE_STACKSIZE, or 0
+u4_t stacksizeoverride() {
   const char *u = getenv("MASSIVE_STACKSIZE");
-  if (u) {
-    s = atoi(u);
-  } else {
-    s = 2048;
+  return u ? (u4_t) atoi(u) : 0;
+}
+
+/* MASSIVE_HUGEPAGES backs the stacks with huge pages. 2M and 1G ask for
+   pages of that size from the hugetlbfs pool, and use transparent huge
+   pages if the pool has too few. thp only asks for transparent huge pages.
+   MASSIVE_PREFAULT makes every thread touch its stack at startup, so that
+   page faults do not show up in the timings later
+*/
+
+// the size that stacks are rounded up to, or 0 without huge pages
+size_t hugepagesize() {
+  const char *h = getenv("MASSIVE_HUGEPAGES");
+  if (!h) {
+    return 0;
+  }
+  if (strcmp(h, "1G") == 0) {
+    return (size_t) 1 << 30;
+  }
+  if (strcmp(h, "2M") == 0 || strcmp(h, "thp") == 0) {
+    return (size_t) 1 << 21;
+  }
+  fprintf(stderr, RED "Error: undefined huge page size %s, use 2M, 1G or thp." WHITE "\n", h);
+  exit(EXIT_FAILURE);
+}
+
+#if !defined(__APPLE__) && defined(MAP_HUGETLB)
+// b bytes in huge pages local to this thread, t is set if they are transparent
+static unsigned char *allocate_huge(size_t b, size_t p, u4_t *t) {
+  *t = 0;
+  if (strcmp(getenv("MASSIVE_HUGEPAGES"), "thp") != 0) {
+    int const f = (p == ((size_t) 1 << 30)) ? (30 << MAP_HUGE_SHIFT) : (21 << MAP_HUGE_SHIFT);
+    void *a = mmap(NULL, b, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | f, -1, 0);
+    if (a != MAP_FAILED) {
+      numa_setlocal_memory(a, b);
+      return (unsigned char*) a;
+    }
+  }
+
+  // transparent huge pages need 2 MB alignment, the rest is given back
+  size_t const q = (size_t) 1 << 21;
+  unsigned char *a = (unsigned char*) mmap(NULL, b + q, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (a == MAP_FAILED) {
+    return NULL;
+  }
+  unsigned char *c = (unsigned char*) (((uintptr_t) a + q - 1) & ~((uintptr_t) q - 1));
+  if (c > a) {
+    munmap(a, c - a);
+  }
+  if (a + b + q > c + b) {
+    munmap(c + b, a + b + q - (c + b));
+  }
+
+  madvise(c, b, MADV_HUGEPAGE);
+  numa_setlocal_memory(c, b);
+
+  *t = 1;
+  return c;
+}
+
+// the part of the b bytes at c that the kernel has backed with transparent
+// huge pages, from /proc/self/smaps
+static f8_t thpcoverage(unsigned char *c, size_t b) {
+  FILE *fp = fopen("/proc/self/smaps", "r");
+  if (!fp) {
+    return 0.0;
+  }
+
+  char l[512];
+  u4_t found = 0;
+  unsigned long long k = 0;
+  while (fgets(l, sizeof(l), fp)) {
+    unsigned long long u, v;
+    if (sscanf(l, "%llx-%llx ", &u, &v) == 2) {
+      found = (uintptr_t) c >= u && (uintptr_t) c < v;
+    } else if (found && sscanf(l, "AnonHugePages: %llu kB", &k) == 1) {
+      break;
+    }
+  }
+  fclose(fp);
+
+  return (f8_t) k * 1024.0 / (f8_t) b;
+}
+#endif
+
+static unsigned char *chunkdata(chunk_t *c) {
+  return (unsigned char*) c + DIV_UP(sizeof(chunk_t), clb) * clb;
+}
+
+static size_t stackused() {
+  if (stack_chunk) {
+    return stack_chunk->below + (size_t) (stack_begin - chunkdata(stack_chunk));
+  }
+  return (size_t) (stack_begin - stack_info->base);
+}
+
+// updates the high-water mark. usage peaks just before it goes down, so
+// it is enough to look whenever memory is given back
+static void notestack() {
+  if (stack_info) {
+    size_t const u = stackused();
+    if (u > stack_info->high) {
+      stack_info->high = u;
+    }
+  }
+}
+
+void reportstack() {
+  notestack();
+
+  fprintf(stderr, "Stack high-water marks:\n");
+  for (u4_t i = 0; i < nstackinfos; i++) {
+    stackinfo_t *s = stackinfos[i];
+    if (s->team < 0) {
+      fprintf(stderr, "  shared: %.1f of %.1f MB, %u chunks added\n",
+        (f8_t) s->high / 1048576.0, (f8_t) s->size / 1048576.0, s->chunks);
+    } else {
+      fprintf(stderr, "  team %d: %.1f of %.1f MB, %u chunks added\n", s->team,
+        (f8_t) s->high / 1048576.0, (f8_t) s->size / 1048576.0, s->chunks);
+    }
+  }
+}
+
+static void popchunk();
+
+static void freestack(stackinfo_t *s) {
+  #ifndef __APPLE__
+    munmap(s->base, s->size); // numa_alloc_local and allocate_huge both map
+  #else
+    free(s->base);
+  #endif
+}
+
+/* b bytes, or MASSIVE_STACKSIZE or 2048 MB if b is 0. the previous stack
+   of this thread is reused if it has the same size and freed otherwise,
+   with everything on it, unless it is the shared stack
+*/
+void allocate_stack(size_t b) {
+  notestack(); // of the previous stack of this thread, if any
+
+  if (b == 0) {
+    u4_t o = stacksizeoverride();
+    b = (size_t) (o > 0 ? o : 2048) * 1024 * 1024;
+  }
+  size_t p = hugepagesize();
+  if (p > b) {
+    p = (size_t) 1 << 21; // small stacks, e.g. the shared one, use 2 MB pages
+  }
+  if (p > 0) {
+    b = DIV_UP(b, p) * p;
   }
 
-  size_t b = (size_t) s * 1024 * 1024;
+  if (stack_info && stack_info->team >= 0) {
+    while (stack_chunk) {
+      popchunk();
+    }
+    if (stack_info->size == b) {
+      stack_begin = stack_info->base;
+      stack_end = stack_begin + b;
+      return;
+    }
+    freestack(stack_info);
+  }
+  u4_t const s = (u4_t) DIV_UP(b, 1024 * 1024);
   #ifndef __APPLE__
-  	stack_begin = (unsigned char*) numa_alloc_local(b);
+    u4_t t = 0;
+    #ifdef MAP_HUGETLB
+      if (p > 0) {
+        stack_begin = allocate_huge(b, p, &t);
+      } else {
+        stack_begin = (unsigned char*) numa_alloc_local(b);
+      }
+    #else
+      stack_begin = (unsigned char*) numa_alloc_local(b);
+    #endif
     if (!stack_begin) {
       fprintf(stderr, RED "Error: failed to allocate %u MB of stack for team %d on node %d.\n" WHITE, s, omp_get_thread_num(), numa_node_of_cpu(sched_getcpu()));
       exit(EXIT_FAILURE);
@@ -52,6 +250,129 @@ void allocate_stack() {
     }
   #endif
   stack_end = stack_begin + b;
+
+  stack_chunk = NULL;
+  stack_info = (stackinfo_t*) calloc(1, sizeof(stackinfo_t));
+  stack_info->team = omp_get_thread_num();
+  stack_info->base = stack_begin;
+  stack_info->size = b;
+
+  #pragma omp critical(stackinfo)
+  {
+    if (nstackinfos == 0) {
+      atexit(reportstack);
+    }
+    if (nstackinfos < sizeof(stackinfos) / sizeof(stackinfos[0])) {
+      stackinfos[nstackinfos++] = stack_info;
+    }
+  }
+
+  if (getenv("MASSIVE_PREFAULT")) {
+    f8_t const t0 = omp_get_wtime();
+    size_t const g = sysconf(_SC_PAGESIZE);
+    for (size_t o = 0; o < b; o += g) {
+      stack_begin[o] = 0;
+    }
+    fprintf(stderr, "Prefaulted the stack of team %d in %.3f s.\n", omp_get_thread_num(), omp_get_wtime() - t0);
+  }
+
+  #if !defined(__APPLE__) && defined(MAP_HUGETLB)
+    if (p > 0 && !t) {
+      fprintf(stderr, "Stack of team %d is in %zu MB pages.\n", omp_get_thread_num(), p >> 20);
+    } else if (p > 0) {
+      fprintf(stderr, "Stack of team %d is in transparent huge pages, %.0f%% so far.\n", omp_get_thread_num(), 100.0 * thpcoverage(stack_begin, b));
+    }
+  #endif
+}
+
+// the memory that can be allocated without swapping, in bytes
+size_t availablememory() {
+  #ifndef __APPLE__
+    FILE *fp = fopen("/proc/meminfo", "r");
+    if (fp) {
+      char l[256];
+      unsigned long long k;
+      while (fgets(l, sizeof(l), fp)) {
+        if (sscanf(l, "MemAvailable: %llu kB", &k) == 1) {
+          fclose(fp);
+          return (size_t) k * 1024;
+        }
+      }
+      fclose(fp);
+    }
+  #endif
+  return (size_t) sysconf(_SC_PHYS_PAGES) * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+// the NUMA nodes that memory can be placed on, 1 without NUMA
+u4_t numanodes() {
+  #ifndef __APPLE__
+    if (numa_available() >= 0) {
+      return (u4_t) numa_num_configured_nodes();
+    }
+  #endif
+  return 1;
+}
+
+// the node of the core this thread runs on
+int threadnode() {
+  #ifndef __APPLE__
+    if (numa_available() >= 0) {
+      return numa_node_of_cpu(sched_getcpu());
+    }
+  #endif
+  return 0;
+}
+
+// the node of the page at p, or -1 if unknown
+int addressnode(void *p) {
+  #ifndef __APPLE__
+    int node;
+    if (numa_available() >= 0 && get_mempolicy(&node, NULL, 0, p, MPOL_F_NODE | MPOL_F_ADDR) == 0) {
+      return node;
+    }
+  #endif
+  (void) p;
+  return -1;
+}
+
+void* allocate_onnode(size_t b, int node) {
+  void *p;
+  #ifndef __APPLE__
+    p = numa_alloc_onnode(b, node);
+  #else
+    (void) node;
+    p = malloc(b);
+  #endif
+  if (!p) {
+    fprintf(stderr, RED "Error: failed to allocate %zu MB on node %d." WHITE "\n", b >> 20, node);
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+// pages spread over all nodes, for data that threads on every node read
+void* allocate_interleaved(size_t b) {
+  void *p;
+  #ifndef __APPLE__
+    p = numa_alloc_interleaved(b);
+  #else
+    p = malloc(b);
+  #endif
+  if (!p) {
+    fprintf(stderr, RED "Error: failed to allocate %zu MB interleaved." WHITE "\n", b >> 20);
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+void free_numa(void *p, size_t b) {
+  #ifndef __APPLE__
+    numa_free(p, b);
+  #else
+    (void) b;
+    free(p);
+  #endif
 }
 
 // taken from https://github.com/chrchang/plink-ng, plink2/pgenlib_internal.h
@@ -67,22 +388,118 @@ static inline uintptr_t round_up_pow2(uintptr_t val, uintptr_t alignment) {
 void clalign_stack() {
   stack_begin = (unsigned char*) round_up_pow2((uintptr_t) stack_begin, clb);
   if (stack_begin > stack_end) {
-    fprintf(stderr, RED "Error: stack overflow, please increase stack size using MASSIVE_STACKSIZE. \n" WHITE);
-    exit(EXIT_FAILURE);
+    stack_begin = stack_end; // the next allocation starts a chunk
   }
 }
 
+static void freechunk(chunk_t *c) {
+  #ifndef __APPLE__
+    numa_free(c, c->size);
+  #else
+    free(c);
+  #endif
+}
+
+// makes room for s bytes in a chunk
+static void growstack(size_t s) {
+  size_t const h = DIV_UP(sizeof(chunk_t), clb) * clb;
+  size_t const b = DIV_UP(h + s, chunksize) * chunksize;
+
+  notestack();
+  size_t const u = stack_info ? stackused() : 0;
+
+  chunk_t *c = NULL;
+  if (stack_spare && stack_spare->size >= h + s) {
+    c = stack_spare;
+    stack_spare = NULL;
+  } else {
+    #ifndef __APPLE__
+      c = (chunk_t*) numa_alloc_local(b);
+    #else
+      c = (chunk_t*) malloc(b);
+    #endif
+    if (!c) {
+      fprintf(stderr, RED "Error: failed to grow the stack of team %d by %zu MB." WHITE "\n", omp_get_thread_num(), b >> 20);
+      exit(EXIT_FAILURE);
+    }
+    c->size = b;
+    if (stack_info) {
+      stack_info->chunks++;
+    }
+  }
+
+  c->prev = stack_chunk;
+  c->begin = stack_begin;
+  c->end = stack_end;
+  c->below = u;
+
+  stack_chunk = c;
+  stack_begin = chunkdata(c);
+  stack_end = (unsigned char*) c + c->size;
+}
+
+static void popchunk() {
+  chunk_t *c = stack_chunk;
+  stack_begin = c->begin;
+  stack_end = c->end;
+  stack_chunk = c->prev;
+
+  if (!stack_spare) {
+    stack_spare = c;
+  } else if (stack_spare->size < c->size) {
+    freechunk(stack_spare);
+    stack_spare = c;
+  } else {
+    freechunk(c);
+  }
+}
+
+// the stack that main keeps its own data on while the teams have theirs
+void allocate_sharedstack(size_t b) {
+  allocate_stack(b);
+  stack_info->team = -1;
+}
+
+stackmark_t mark_stack() {
+  stackmark_t m = {stack_begin, stack_end, stack_chunk, stack_info};
+  return m;
+}
+
+void release_stack(stackmark_t m) {
+  notestack();
+  while (stack_chunk && stack_chunk != m.chunk) {
+    popchunk();
+  }
+  stack_begin = m.begin;
+  stack_end = m.end;
+  stack_chunk = m.chunk;
+  stack_info = (stackinfo_t*) m.info;
+}
+
+void attach_stack(unsigned char *b, size_t s) {
+  notestack();
+  stack_begin = b;
+  stack_end = b + s;
+  stack_chunk = NULL;
+  stack_info = NULL;
+}
+
 unsigned char* allocate_u1(size_t s) {
+  if (s > (size_t) (stack_end - stack_begin)) {
+    growstack(s);
+  }
   unsigned char* p = stack_begin;
   stack_begin += s;
-  if (stack_begin > stack_end) {
-    fprintf(stderr, RED "Error: stack overflow, please increase stack size using MASSIVE_STACKSIZE. \n" WHITE);
-    exit(EXIT_FAILURE);
-  }
   return p;
 }
 
 void free_u1(size_t s) {
+  notestack();
+  // an allocation never spans chunks, so if it does not fit below the
+  // stack in this chunk, it is in an earlier one
+  while (stack_chunk && (size_t) (stack_begin - chunkdata(stack_chunk)) < s) {
+    popchunk();
+  }
   stack_begin -= s;
 }
 
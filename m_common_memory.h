@@ -25,15 +25,48 @@
 #ifndef __APPLE__
   #include <sched.h>
   #include <numa.h>
+  #include <numaif.h>
+  #include <sys/mman.h>
 #endif
 
 extern unsigned char* stack_begin;
 extern unsigned char* stack_end;
 #pragma omp threadprivate(stack_begin, stack_end)
 
-void allocate_stack();
+typedef struct chunk chunk_t;
+
+// a position on the stack, see mark_stack
+typedef struct {
+  unsigned char *begin;
+  unsigned char *end;
+  chunk_t *chunk;
+  void *info;
+} stackmark_t;
+
+u4_t stacksizeoverride();
+size_t hugepagesize();
+void allocate_stack(size_t b);
+void allocate_sharedstack(size_t b);
+size_t availablememory();
 void clalign_stack();
 
+// release_stack frees everything allocated since mark_stack
+stackmark_t mark_stack();
+void release_stack(stackmark_t m);
+
+// makes s bytes at b the stack of this thread until release_stack
+void attach_stack(unsigned char *b, size_t s);
+
+void reportstack();
+
+// memory outside the stacks, placed on NUMA nodes explicitly
+u4_t numanodes();
+int threadnode();
+int addressnode(void *p);
+void* allocate_onnode(size_t b, int node);
+void* allocate_interleaved(size_t b);
+void free_numa(void *p, size_t b);
+
 unsigned char* allocate_u1(size_t s);
 void free_u1(size_t s);
 
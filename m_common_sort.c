@@ -15,67 +15,294 @@
 
 #include "m_common_sort.h"
 
-static inline void swap(f4_t * a,
-  u4_t i, u4_t j) {
-  f4_t b = a[i];
-  a[i] = a[j];
-  a[j] = b;
+/* floats are sorted by the bits of their keys, which order like the floats
+   once negative values have all bits flipped and positive ones the sign
+   bit. the lsd radix sort makes four passes of a
+   byte each, and skips the bytes that all keys share, such as the exponent
+   of weights in [0.5, 1). every pass counts the bytes of each thread's part
+   and then scatters the part after the same bytes of earlier parts, so the
+   sort is stable and takes the same time for any input, ties included
+*/
+
+static u4_t const radixsize = 256;
+static u4_t const maxthreads = 64;
+static size_t const minpart = 65536; // values per thread, at least
+
+static inline u4_t floatkey(f4_t v) {
+  v += 0.0f; // -0.0 ties with 0.0
+  u4_t u;
+  memcpy(&u, &v, sizeof(u));
+  return u ^ ((u4_t) ((int32_t) u >> 31) | 0x80000000u);
 }
 
-static inline u4_t partition(f4_t * restrict a,
-  u4_t l, u4_t h) {
+static u4_t sortthreads(size_t n) {
+  size_t t = (size_t) omp_get_max_threads();
+  if (t > maxthreads) {
+    t = maxthreads;
+  }
+  if (t > n / minpart + 1) {
+    t = n / minpart + 1;
+  }
+  return (u4_t) t;
+}
+
+// counts that radix needs for nth threads
+static size_t radixcounts(u4_t nth) {
+  return (size_t) (nth + 1) * 4*radixsize;
+}
+
+/* sorts x and the payload a, if not NULL, with y and b of the same size as
+   scratch. the result is in y and b if it returns 1
+*/
+static u4_t radix(f4_t *x, f4_t *y, u4_t *a, u4_t *b,
+  size_t n, u4_t nth, u8_t *c) {
+  u8_t *g = &c[(size_t) nth*4*radixsize]; // of all parts
+
+  u4_t nt = 1;
+
+  #pragma omp parallel num_threads(nth)
+  {
+    u4_t const t = omp_get_thread_num();
+    #pragma omp single
+    nt = omp_get_num_threads();
+
+    size_t const i0 = n*t/nt;
+    size_t const i1 = n*(t+1)/nt;
+    u8_t *ct = &c[(size_t) t*4*radixsize];
+    memset(ct, 0, 4*radixsize * sizeof(u8_t));
+    for (size_t i = i0; i < i1; i++) {
+      u4_t const k = floatkey(x[i]);
+      ct[k & 0xff]++;
+      ct[radixsize + ((k >> 8) & 0xff)]++;
+      ct[2*radixsize + ((k >> 16) & 0xff)]++;
+      ct[3*radixsize + (k >> 24)]++;
+    }
+  }
+  for (u4_t v = 0; v < 4*radixsize; v++) {
+    g[v] = 0;
+    for (u4_t t = 0; t < nt; t++) {
+      g[v] += c[(size_t) t*4*radixsize+v];
+    }
+  }
+
+  u4_t r = 0;
+  for (u4_t d = 0; d < 4; d++) {
+    u4_t trivial = 0;
+    for (u4_t v = 0; v < radixsize; v++) {
+      trivial |= (g[d*radixsize+v] == n);
+    }
+    if (trivial) {
+      continue;
+    }
 
-  f4_t p = a[l];
-  u4_t i = l;
-  u4_t j = h+1;
-  for (;;) {
-    do {
-      i++;
-    } while (a[i] <= p && i <= h);
+    u4_t const sh = 8*d;
 
-    do {
-      j--;
-    } while (a[j] > p);
+    #pragma omp parallel num_threads(nth)
+    {
+      u4_t const t = omp_get_thread_num();
+      u4_t const nt = omp_get_num_threads();
+      size_t const i0 = n*t/nt;
+      size_t const i1 = n*(t+1)/nt;
+      u8_t *ct = &c[(size_t) t*radixsize];
 
-    if (i >= j) {
-      break;
+      memset(ct, 0, radixsize * sizeof(u8_t));
+      for (size_t i = i0; i < i1; i++) {
+        ct[(floatkey(x[i]) >> sh) & 0xff]++;
+      }
+
+      #pragma omp barrier
+      #pragma omp single
+      {
+        u8_t o = 0;
+        for (u4_t v = 0; v < radixsize; v++) {
+          for (u4_t tt = 0; tt < nt; tt++) {
+            u8_t const q = c[(size_t) tt*radixsize+v];
+            c[(size_t) tt*radixsize+v] = o;
+            o += q;
+          }
+        }
+      }
+
+      if (a) {
+        for (size_t i = i0; i < i1; i++) {
+          u8_t const p = ct[(floatkey(x[i]) >> sh) & 0xff]++;
+          y[p] = x[i];
+          b[p] = a[i];
+        }
+      } else {
+        for (size_t i = i0; i < i1; i++) {
+          y[ct[(floatkey(x[i]) >> sh) & 0xff]++] = x[i];
+        }
+      }
     }
 
-    swap(a, i, j);
+    f4_t *xx = x;
+    x = y;
+    y = xx;
+    u4_t *aa = a;
+    a = b;
+    b = aa;
+    r ^= 1;
   }
 
-  swap(a, l, j);
+  return r;
+}
 
-  return j;
+// bytes of stack that psort, radixsort and samplesort need for n values
+size_t sortsize(size_t n) {
+  return n * sizeof(f4_t) + (size_t) 16*maxthreads * sizeof(u4_t) + \
+    ((size_t) maxthreads * (2*maxthreads + radixcounts(1)) + radixcounts(maxthreads)) * sizeof(u8_t) + \
+    4*clb;
 }
 
-static inline void recurrence(f4_t * restrict a,
-  u4_t l, u4_t h, u4_t o) {
+void radixsort(f4_t * restrict x,
+  size_t n) {
+  if (n < 2) {
+    return;
+  }
+  stackmark_t mark = mark_stack();
 
-  if (l < h) {
-    u4_t p = partition(a, l, h);
+  u4_t const nth = sortthreads(n);
+  f4_t *y = allocate_f4(n);
+  u8_t *c = allocate_u8(radixcounts(nth));
+
+  if (radix(x, y, NULL, NULL, n, nth, c)) {
+    memcpy(x, y, n * sizeof(f4_t));
+  }
+
+  release_stack(mark);
+}
+
+/* a sample of 16 keys per thread picks a splitter between the parts of
+   every two threads. keys equal to a splitter go into a bucket of their
+   own, which is sorted already, so that many ties, e.g. the zeros of a
+   thresholded network, do not make one part much larger than the others.
+   the buckets are then radix sorted by one thread each
+*/
+static u8_t samplehash(u8_t h) {
+  h += 0x9e3779b97f4a7c15ULL;
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return h ^ (h >> 31);
+}
+
+static int compareu4(void const *a, void const *b) {
+  u4_t x = *(u4_t const*) a;
+  u4_t y = *(u4_t const*) b;
+  return (x > y) - (x < y);
+}
 
-    if (h-l < o) {
-      recurrence(a, l, p-1, o);
-      recurrence(a, p+1, h, o);
+// the bucket of k among the u splitters s
+static inline u4_t bucket(u4_t const *s, u4_t u, u4_t k) {
+  u4_t l = 0;
+  u4_t h = u;
+  while (l < h) {
+    u4_t const m = (l + h) / 2;
+    if (s[m] < k) {
+      l = m + 1;
     } else {
-      #pragma omp task
-      recurrence(a, l, p-1, o);
-      #pragma omp task
-      recurrence(a, p+1, h, o);
-      #pragma omp taskwait
+      h = m;
     }
   }
+  return (l < u && s[l] == k) ? 2*l+1 : 2*l;
 }
 
-void pquicksort(f4_t * restrict a,
-  u4_t n) {
+void samplesort(f4_t * restrict x,
+  size_t n) {
+  u4_t const nth = sortthreads(n);
+  if (nth < 2) {
+    radixsort(x, n);
+    return;
+  }
+  stackmark_t mark = mark_stack();
+
+  u4_t const ns = 16*nth;
+  u4_t *sk = allocate_u4(ns);
+  for (u4_t q = 0; q < ns; q++) {
+    sk[q] = floatkey(x[samplehash(q) % n]);
+  }
+  qsort(sk, ns, sizeof(u4_t), compareu4);
+
+  u4_t s[maxthreads];
+  u4_t u = 0;
+  for (u4_t q = 1; q < nth; q++) {
+    u4_t const k = sk[16*q];
+    if (u == 0 || s[u-1] != k) {
+      s[u++] = k;
+    }
+  }
+  u4_t const nb = 2*u+1;
+
+  f4_t *y = allocate_f4(n);
+  u8_t *c = allocate_u8((size_t) nth*nb + nb + 1);
+  u8_t *bo = &c[(size_t) nth*nb]; // where the buckets begin
+  u8_t *cr = allocate_u8((size_t) nth*radixcounts(1));
+
+  u4_t nt = 1;
 
-  #pragma omp parallel shared(a)
-  #pragma omp single nowait
+  #pragma omp parallel num_threads(nth)
   {
-    u4_t o = DIV_UP(n, omp_get_num_threads());
-    recurrence(a, 0, n-1, o);
+    u4_t const t = omp_get_thread_num();
+    #pragma omp single
+    nt = omp_get_num_threads();
+
+    size_t const i0 = n*t/nt;
+    size_t const i1 = n*(t+1)/nt;
+    u8_t *ct = &c[(size_t) t*nb];
+
+    memset(ct, 0, nb * sizeof(u8_t));
+    for (size_t i = i0; i < i1; i++) {
+      ct[bucket(s, u, floatkey(x[i]))]++;
+    }
+
+    #pragma omp barrier
+    #pragma omp single
+    {
+      u8_t o = 0;
+      for (u4_t v = 0; v < nb; v++) {
+        bo[v] = o;
+        for (u4_t tt = 0; tt < nt; tt++) {
+          u8_t const q = c[(size_t) tt*nb+v];
+          c[(size_t) tt*nb+v] = o;
+          o += q;
+        }
+      }
+      bo[nb] = o;
+    }
+
+    for (size_t i = i0; i < i1; i++) {
+      y[ct[bucket(s, u, floatkey(x[i]))]++] = x[i];
+    }
+
+    #pragma omp barrier
+
+    #pragma omp for schedule(dynamic, 1)
+    for (u4_t v = 0; v < nb; v++) {
+      size_t const b0 = bo[v];
+      size_t const m = bo[v+1] - b0;
+      if (v % 2 == 0 && m > 1) {
+        if (radix(&y[b0], &x[b0], NULL, NULL, m, 1, &cr[(size_t) t*radixcounts(1)])) {
+          continue; // in x already
+        }
+      }
+      memcpy(&x[b0], &y[b0], m * sizeof(f4_t));
+    }
+  }
+
+  release_stack(mark);
+}
+
+/* sorts x in ascending order. the scatter of the radix sort writes to 256
+   places per thread, which gets slow once many threads share the caches
+   and write buffers, so with more than 8 threads the sample sort splits
+   the values into one range per thread first
+*/
+void psort(f4_t * restrict x,
+  size_t n) {
+  if (sortthreads(n) > 8) {
+    samplesort(x, n);
+  } else {
+    radixsort(x, n);
   }
 }
 
@@ -98,21 +325,34 @@ void quicksort(f4_t * restrict a,
   qsort(a, n, sizeof(f4_t), compare);
 }
 
+// bytes of stack that argsort needs for n values
+size_t argsortsize(size_t n) {
+  return 2*n * sizeof(f4_t) + n * sizeof(u4_t) + \
+    radixcounts(maxthreads) * sizeof(u8_t) + 4*clb;
+}
+
+// the order of b in a, ties in the order of their index
 void argsort(u4_t * restrict a,
   f4_t * restrict b,
   u4_t n) {
-
-  for (u4_t i = 0; i < (int) n; i++) {
+  for (u4_t i = 0; i < n; i++) {
     a[i] = i;
   }
+  if (n < 2) {
+    return;
+  }
+  stackmark_t mark = mark_stack();
 
-  for (int i = 0; i < (int) n - 1; i++) {
-    for (int j = 0; j < (int) n - i - 1; j++) {
-      if (b[a[j]] > b[a[j+1]]) {
-        u4_t s = a[j];
-        a[j] = a[j+1];
-        a[j+1] = s;
-      }
-    }
+  u4_t const nth = sortthreads(n);
+  f4_t *x = allocate_f4(n);
+  f4_t *y = allocate_f4(n);
+  u4_t *ay = allocate_u4(n);
+  u8_t *c = allocate_u8(radixcounts(nth));
+
+  memcpy(x, b, n * sizeof(f4_t));
+  if (radix(x, y, a, ay, n, nth, c)) {
+    memcpy(a, ay, n * sizeof(u4_t));
   }
+
+  release_stack(mark);
 }
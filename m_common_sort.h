@@ -22,8 +22,14 @@
   #include <omp.h>
 #endif
 
-void pquicksort(f4_t * restrict x, u4_t n);
+size_t sortsize(size_t n);
+void psort(f4_t * restrict x, size_t n);
+void radixsort(f4_t * restrict x, size_t n);
+void samplesort(f4_t * restrict x, size_t n);
+
 void quicksort(f4_t * restrict x, u4_t n);
+
+size_t argsortsize(size_t n);
 void argsort(u4_t * restrict a, f4_t * restrict b, u4_t n);
 
 #endif
@@ -27,7 +27,21 @@
   typedef __m256 vf4_t;
   typedef __m256i vu4_t;
 #else
-  #error
+  typedef __m128 vf4_t;
+  typedef __m128i vu4_t;
+#endif
+
+/* with make PORTABLE=1 the baseline is plain x86-64, and the kernels marked
+   DISPATCH are compiled once more for each of the levels below. the loader
+   resolves them once from cpuid, to the best level the cpu supports
+*/
+#if defined(MASSIVE_PORTABLE) && defined(__GNUC__) && !defined(__clang__) && \
+  !defined(__INTEL_COMPILER) && defined(__x86_64__)
+  #define MASSIVE_DISPATCH
+  #define DISPATCH __attribute__((target_clones("arch=x86-64-v4", \
+    "arch=x86-64-v3", "arch=x86-64-v2", "default")))
+#else
+  #define DISPATCH
 #endif
 
 /*
@@ -0,0 +1,169 @@
+// This library is part of Massive, copyright 2017 Lea Waller.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "m_imaginggenetics.h"
+
+static const char usage[] = \
+"Usage: m_imaginggenetics -g <genotypes> -p <phenotypes> -o <output> <options>\n"\
+"\n"\
+"Required arguments:\n"\
+"-g <prefix> plink fileset <prefix>.bed, <prefix>.bim and <prefix>.fam in\n"\
+"snp-major mode\n"\
+"-p <filename> text file where rows are subjects in the order of the .fam\n"\
+"file and columns are phenotypes, separated by spaces or tabs. A first line\n"\
+"without numbers is skipped as a header, and every other row needs a number\n"\
+"for every phenotype. The output of m_brainconnectivity is measure x\n"\
+"network with three header lines, so its values have to be collected into\n"\
+"one row per subject first\n"\
+"-o <prefix> output prefix\n"\
+"\n"\
+"Every phenotype is regressed on the allele dosage of every snp, leaving out\n"\
+"subjects whose genotype is missing. The results are written to\n"\
+"<prefix>.npy as snp x phenotype x statistic, with the statistics beta, se,\n"\
+"t and p, in the order of the .bim file. <prefix>.txt describes the axes.\n"\
+"\n"\
+"Options:\n"\
+"-b <snps> snps per block, by default as many as decode to 64 MB\n"\
+"-d debug\n";
+
+static char const *statistics[nassociation] = {"beta", "se", "t", "p"};
+
+static void writedescription(char *fo, char *fg, u4_t k) {
+  char f[4096];
+  snprintf(f, sizeof(f), "%s.txt", fo);
+  FILE *fp = fopen(f, "w");
+  if (!fp) {
+    fprintf(stderr, RED "Failed to open %s for writing." WHITE "\n", f);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(fp, "snp\t%s.bim\n", fg);
+  fprintf(fp, "phenotype");
+  for (u4_t q = 0; q < k; q++) {
+    fprintf(fp, "\t%u", q);
+  }
+  fprintf(fp, "\nstatistic");
+  for (u4_t i = 0; i < nassociation; i++) {
+    fprintf(fp, "\t%s", statistics[i]);
+  }
+  fprintf(fp, "\n");
+  fclose(fp);
+}
+
+int main(int argc, char* argv[]) {
+  fputs(version, stdout);
+
+  #pragma omp parallel
+  #pragma omp single
+  fprintf(stderr, "Using %u threads.\n", (u4_t) omp_get_num_threads());
+  fprintf(stderr, "Using %s kernels.\n", kernellevel());
+
+  char *fg = NULL;
+  char *fp = NULL;
+  char *fo = NULL;
+  u4_t bs = 0;
+
+  char cc;
+  while ((cc = getopt(argc, argv, "g:p:o:b:d")) != -1) {
+    switch (cc) {
+      case 'g':
+        fg = optarg;
+        break;
+      case 'p':
+        fp = optarg;
+        break;
+      case 'o':
+        fo = optarg;
+        break;
+      case 'b':
+        bs = (u4_t) atoi(optarg);
+        break;
+
+      case 'd':
+        debug = 1;
+        printf("debug = %u\n", debug);
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  if (!fg || !fp || !fo) {
+    fprintf(stderr, RED "Error: missing arguments." WHITE "\n\n%s", usage);
+    exit(EXIT_FAILURE);
+  }
+
+  genotype_t g;
+  map_genotype(fg, &g);
+
+  u4_t n[2];
+  read_txt_dim(fp, &n[0]);
+  if (n[0] != g.n) {
+    fprintf(stderr, RED "Error: %s has %u rows, but there are %u subjects." WHITE "\n", fp, n[0], g.n);
+    exit(EXIT_FAILURE);
+  }
+  u4_t const k = n[1];
+  if (g.n < 3 || k == 0) {
+    fprintf(stderr, RED "Error: too few subjects or phenotypes." WHITE "\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (bs == 0) { // 64 MB of dosages
+    bs = (u4_t) MAX(1, ((size_t) 64 << 20) / (4*g.v * sizeof(f4_t)));
+  }
+  if (bs > g.ns) {
+    bs = g.ns;
+  }
+
+  size_t const s = read_txt_size(k) + (size_t) g.n*k * sizeof(f4_t) + \
+    associationsize(bs, g.n, k) + (size_t) bs*k*nassociation * sizeof(f4_t) + 4*clb;
+  allocate_stack(s);
+
+  f4_t *y;
+  read_txt_columns_f4(fp, &n[0], &y);
+  for (size_t i = 0; i < (size_t) g.n*k; i++) {
+    if (!isfinite(y[i])) {
+      fprintf(stderr, RED "Error: %s has a phenotype that is not finite." WHITE "\n", fp);
+      exit(EXIT_FAILURE);
+    }
+  }
+  clalign_stack();
+  f4_t *o = allocate_f4((size_t) bs*k*nassociation);
+
+  u4_t const d[3] = {g.ns, k, nassociation};
+
+  char f[4096];
+  snprintf(f, sizeof(f), "%s.npy", fo);
+
+  fprintf(stderr, "%u subjects, %u snps, %u phenotypes, %u snps per block.\n", g.n, g.ns, k, bs);
+
+  for (u4_t s0 = 0; s0 < g.ns; s0 += bs) {
+    u4_t const s1 = (s0 + bs < g.ns) ? s0 + bs : g.ns;
+
+    association(&g.g[(size_t) s0*g.v], g.v, s1 - s0, g.n, y, k, o);
+    write_npy_block_f4(f, &d[0], 3, (size_t) s0*k*nassociation, o,
+      (size_t) (s1 - s0)*k*nassociation);
+    release_genotype(&g, s0, s1);
+
+    fprintf(stderr, "\r%f%%", 100.0 * s1 / g.ns);
+  }
+  fprintf(stderr, "\n");
+
+  write_npy_header_f4(f, &d[0], 3);
+  writedescription(fo, fg, k);
+
+  unmap_genotype(&g);
+}
@@ -0,0 +1,286 @@
+// This library is part of Massive, copyright 2017 Lea Waller.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "m_imaginggenetics_association.h"
+
+/* the genotypes stay packed as in the .bed file, 2 bits per subject with
+   the first subject in the low bits. the codes are 0 for homozygous first
+   allele, 1 for missing, 2 for heterozygous and 3 for homozygous second
+   allele, and the dosage counts the second allele. with l the low and h the
+   high bit of every code in a word of 32 subjects
+
+     het = h & ~l    hom = h & l    missing = l & ~h
+
+   so the sums of a snp are popcounts
+*/
+
+static u8_t const lowbits = 0x5555555555555555ULL;
+
+static u8_t genotypeword(unsigned char const *g, size_t v, size_t i) {
+  u8_t w = 0; // the tail is padded with homozygous codes, which count nothing
+  memcpy(&w, &g[i], (i + sizeof(w) <= v) ? sizeof(w) : v - i);
+  return w;
+}
+
+DISPATCH void genotypesums(unsigned char const *g, u4_t n,
+  u4_t *c, u4_t *s, u4_t *ss) {
+  size_t const v = DIV_UP(n, 4);
+
+  u4_t m = 0;
+  u4_t het = 0;
+  u4_t hom = 0;
+  for (size_t i = 0; i < v; i += sizeof(u8_t)) {
+    u8_t const w = genotypeword(g, v, i);
+    u8_t const l = w & lowbits;
+    u8_t const h = (w >> 1) & lowbits;
+    het += __builtin_popcountll(h & ~l);
+    hom += __builtin_popcountll(h & l);
+    m += __builtin_popcountll(l & ~h);
+  }
+
+  *c = n - m;
+  *s = het + 2*hom;
+  *ss = het + 4*hom;
+}
+
+// dosages of the four subjects of every byte, missing is zero
+#define DOSE(b, q) ((f4_t) ((((b) >> (2*(q))) & 3) == 3 ? 2 : \
+  (((b) >> (2*(q))) & 3) == 2 ? 1 : 0))
+#define DOSE1(b) {DOSE(b, 0), DOSE(b, 1), DOSE(b, 2), DOSE(b, 3)}
+#define DOSE4(b) DOSE1(b), DOSE1(b+1), DOSE1(b+2), DOSE1(b+3)
+#define DOSE16(b) DOSE4(b), DOSE4(b+4), DOSE4(b+8), DOSE4(b+12)
+#define DOSE64(b) DOSE16(b), DOSE16(b+16), DOSE16(b+32), DOSE16(b+48)
+
+static f4_t const dosage[256][4] = {
+  DOSE64(0), DOSE64(64), DOSE64(128), DOSE64(192)
+};
+
+// d receives 4*DIV_UP(n, 4) dosages, the padding is zero
+void decodegenotype(unsigned char const *g, u4_t n,
+  f4_t *d) {
+  size_t const v = DIV_UP(n, 4);
+  for (size_t i = 0; i < v; i++) {
+    memcpy(&d[4*i], dosage[g[i]], sizeof(dosage[0]));
+  }
+}
+
+// sums of the phenotypes over the missing subjects of g
+static void missingsums(unsigned char const *g, u4_t n,
+  f4_t const *y, u4_t k, f8_t *a, f8_t *aa) {
+  size_t const v = DIV_UP(n, 4);
+
+  memset(a, 0, k * sizeof(f8_t));
+  memset(aa, 0, k * sizeof(f8_t));
+
+  for (size_t i = 0; i < v; i += sizeof(u8_t)) {
+    u8_t const w = genotypeword(g, v, i);
+    u8_t m = (w & lowbits) & ~((w >> 1) & lowbits);
+    while (m) {
+      size_t const j = 4*i + __builtin_ctzll(m) / 2;
+      m &= m - 1;
+      if (j >= n) {
+        break;
+      }
+      for (u4_t q = 0; q < k; q++) {
+        f8_t const e = y[(size_t) q*n+j];
+        a[q] += e;
+        aa[q] += e*e;
+      }
+    }
+  }
+}
+
+/* regularized incomplete beta function, by the continued fraction of
+   numerical recipes 6.4
+*/
+static f8_t betacf(f8_t a, f8_t b, f8_t x) {
+  f8_t const tiny = 1e-300;
+
+  f8_t c = 1.0;
+  f8_t d = 1.0 - (a+b) * x / (a+1.0);
+  d = 1.0 / (fabs(d) < tiny ? tiny : d);
+  f8_t h = d;
+
+  for (u4_t m = 1; m < 512; m++) {
+    f8_t const mm = (f8_t) m;
+    f8_t e = mm * (b-mm) * x / ((a+2.0*mm-1.0) * (a+2.0*mm));
+    d = 1.0 + e*d;
+    d = 1.0 / (fabs(d) < tiny ? tiny : d);
+    c = 1.0 + e/c;
+    c = fabs(c) < tiny ? tiny : c;
+    h *= d*c;
+
+    e = -(a+mm) * (a+b+mm) * x / ((a+2.0*mm) * (a+2.0*mm+1.0));
+    d = 1.0 + e*d;
+    d = 1.0 / (fabs(d) < tiny ? tiny : d);
+    c = 1.0 + e/c;
+    c = fabs(c) < tiny ? tiny : c;
+    f8_t const q = d*c;
+    h *= q;
+    if (fabs(q - 1.0) < 1e-15) {
+      break;
+    }
+  }
+
+  return h;
+}
+
+static f8_t betai(f8_t a, f8_t b, f8_t x) {
+  if (x <= 0.0) {
+    return 0.0;
+  }
+  if (x >= 1.0) {
+    return 1.0;
+  }
+  f8_t const f = exp(lgamma(a+b) - lgamma(a) - lgamma(b) + \
+    a * log(x) + b * log(1.0-x));
+  if (x < (a+1.0) / (a+b+2.0)) {
+    return f * betacf(a, b, x) / a;
+  }
+  return 1.0 - f * betacf(b, a, 1.0-x) / b;
+}
+
+// two-sided p value of t with df degrees of freedom
+static f8_t tp(f8_t t, f8_t df) {
+  return betai(0.5*df, 0.5, df / (df + t*t));
+}
+
+size_t associationsize(u4_t ns, u4_t n, u4_t k) {
+  size_t const ld = 4*DIV_UP((size_t) n, 4);
+  return ((size_t) ns*ld + (size_t) n*k + (size_t) ns*k) * sizeof(f4_t) + \
+    ((size_t) 2*ns*k + 2*k) * sizeof(f8_t) + (size_t) 3*ns * sizeof(u4_t) + \
+    6*clb;
+}
+
+/* regresses each of the k phenotypes in the columns of y, n subjects each,
+   on each of the ns snps in g, v bytes each. subjects with a missing
+   genotype are left out of the regressions of that snp. the snps are
+   decoded and summed in parallel, and the products with the phenotypes are
+   a single sgemm. o receives the statistics as ns x k x nassociation
+*/
+DISPATCH void association(unsigned char const *g, size_t v, u4_t ns, u4_t n,
+  f4_t const *y, u4_t k, f4_t *o) {
+  stackmark_t mark = mark_stack();
+
+  size_t const ld = 4*v;
+
+  clalign_stack();
+  f4_t *d = allocate_f4((size_t) ns*ld);
+  clalign_stack();
+  f4_t *yy = allocate_f4((size_t) n*k);
+  clalign_stack();
+  f4_t *c = allocate_f4((size_t) ns*k);
+  clalign_stack();
+  f8_t *a = allocate_f8((size_t) 2*ns*k);
+  clalign_stack();
+  f8_t *t = allocate_f8((size_t) 2*k);
+  clalign_stack();
+  u4_t *sc = allocate_u4((size_t) 3*ns);
+
+  for (u4_t q = 0; q < k; q++) { // demean
+    f8_t s = 0.0;
+    for (u4_t i = 0; i < n; i++) {
+      s += y[(size_t) q*n+i];
+    }
+    f4_t const mu = (f4_t) (s / n);
+    f8_t ss = 0.0;
+    s = 0.0;
+    for (u4_t i = 0; i < n; i++) {
+      f4_t const e = y[(size_t) q*n+i] - mu;
+      yy[(size_t) q*n+i] = e;
+      s += e;
+      ss += (f8_t) e*e;
+    }
+    t[q] = s;
+    t[k+q] = ss;
+  }
+
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (u4_t s = 0; s < ns; s++) {
+    unsigned char const *gs = &g[(size_t) s*v];
+    genotypesums(gs, n, &sc[3*s], &sc[3*s+1], &sc[3*s+2]);
+    decodegenotype(gs, n, &d[(size_t) s*ld]);
+    if (sc[3*s] < n) {
+      missingsums(gs, n, yy, k, &a[(size_t) 2*s*k], &a[(size_t) (2*s+1)*k]);
+    }
+  }
+
+  char ttrans = 't';
+  char ntrans = 'n';
+
+  integer kk = k;
+  integer nns = ns;
+  integer nn = n;
+  integer lld = ld;
+
+  f4_t alpha = 1.0f;
+  f4_t beta = 0.0f;
+
+  FORTRAN_WRAPPER(sgemm)(
+        &ttrans, // c = y' * d
+        &ntrans,
+        &kk,
+        &nns,
+        &nn,
+        &alpha,
+        yy,
+        &nn,
+        d,
+        &lld,
+        &beta,
+        c,
+        &kk);
+
+  #pragma omp parallel for schedule(static)
+  for (u4_t s = 0; s < ns; s++) {
+    f8_t const m = (f8_t) sc[3*s];
+    f8_t const sg = (f8_t) sc[3*s+1];
+    f8_t const sgg = (f8_t) sc[3*s+2];
+    f8_t const vg = m*sgg - sg*sg;
+
+    for (u4_t q = 0; q < k; q++) {
+      f8_t sy = t[q];
+      f8_t syy = t[k+q];
+      if (sc[3*s] < n) {
+        sy -= a[(size_t) 2*s*k+q];
+        syy -= a[(size_t) (2*s+1)*k+q];
+      }
+
+      f4_t *r = &o[((size_t) s*k+q) * nassociation];
+      if (m < 3.0 || vg <= 0.0) {
+        r[association_beta] = NAN;
+        r[association_se] = NAN;
+        r[association_t] = NAN;
+        r[association_p] = NAN;
+        continue;
+      }
+
+      f8_t const vy = m*syy - sy*sy;
+      f8_t const cgy = m*c[(size_t) s*k+q] - sg*sy;
+
+      f8_t const b = cgy / vg;
+      f8_t e = (vy - b*b*vg) / vg / (m - 2.0); // residual over genotype variance
+      e = e > 0.0 ? sqrt(e) : 0.0;
+      f8_t const tt = b / e;
+
+      r[association_beta] = (f4_t) b;
+      r[association_se] = (f4_t) e;
+      r[association_t] = (f4_t) tt;
+      r[association_p] = (f4_t) tp(tt, m - 2.0);
+    }
+  }
+
+  release_stack(mark);
+}
@@ -0,0 +1,41 @@
+// This library is part of Massive, copyright 2017 Lea Waller.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __M_IMAGINGGENETICS_ASSOCIATION_H__
+#define __M_IMAGINGGENETICS_ASSOCIATION_H__
+
+#include "m_common.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+// the statistics of every snp and phenotype, in this order
+enum {
+  association_beta = 0,
+  association_se,
+  association_t,
+  association_p,
+  nassociation
+};
+
+void genotypesums(unsigned char const *g, u4_t n, u4_t *c, u4_t *s, u4_t *ss);
+void decodegenotype(unsigned char const *g, u4_t n, f4_t *d);
+
+void association(unsigned char const *g, size_t v, u4_t ns, u4_t n,
+  f4_t const *y, u4_t k, f4_t *o);
+size_t associationsize(u4_t ns, u4_t n, u4_t k);
+
+#endif
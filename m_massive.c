@@ -0,0 +1,358 @@
+// This library is part of Massive, copyright 2017 Lea Waller.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "massive.h"
+
+#include "m_brainconnectivity.h"
+
+/* the kernels allocate from the stack of the calling thread. for the
+   duration of a call that stack is pointed at the workspace of the
+   context, and restored afterwards. the workspace is checked against the
+   size of the call up front. should a kernel still need more, the stack
+   grows by chunks from the heap, which are given back when the call
+   returns, and the process exits if that fails, see massive.h
+*/
+
+typedef struct {
+  stackmark_t m;
+  int t;
+} saved_t;
+
+static size_t networksize(u4_t n, u4_t m) {
+  size_t const nn = (size_t) n*n;
+  return (size_t) n*m * sizeof(f4_t) + clb + \
+    2 * nn * sizeof(f8_t) + (size_t) n * sizeof(u8_t);
+}
+
+static size_t thresholdssize(u4_t n) {
+  return (size_t) n*n * sizeof(f4_t) + clb + sortsize((size_t) n*n);
+}
+
+static size_t measuressize(u4_t n) {
+  size_t const nn = (size_t) n*n;
+  size_t s = blockfloydwarshallsize(n);
+  if (s < nn * sizeof(f4_t)) {
+    s = nn * sizeof(f4_t); // triangles
+  }
+  return nn * sizeof(f4_t) + clb + s;
+}
+
+size_t massive_workspace(unsigned n, unsigned m) {
+  size_t s = networksize(n, m);
+  if (s < thresholdssize(n)) {
+    s = thresholdssize(n);
+  }
+  if (s < measuressize(n)) {
+    s = measuressize(n);
+  }
+  return s + 2*clb;
+}
+
+int massive_init(massive_t *c, void *workspace, size_t size, int threads) {
+  if (!c || !workspace || threads < 0) {
+    return MASSIVE_EINVAL;
+  }
+  c->workspace = (unsigned char*) workspace;
+  c->size = size;
+  c->threads = threads;
+  return MASSIVE_OK;
+}
+
+static int enter(massive_t *c, size_t s, saved_t *v) {
+  if (!c || !c->workspace) {
+    return MASSIVE_EINVAL;
+  }
+  if (c->size < s + 2*clb) {
+    return MASSIVE_ENOMEM;
+  }
+
+  v->m = mark_stack();
+  attach_stack(c->workspace, c->size);
+  clalign_stack();
+
+  v->t = omp_get_max_threads();
+  if (c->threads > 0) {
+    omp_set_num_threads(c->threads);
+  }
+
+  return MASSIVE_OK;
+}
+
+static void leave(saved_t *v) {
+  release_stack(v->m);
+  omp_set_num_threads(v->t);
+}
+
+static int network(float const *x, u4_t n, u4_t m,
+  int definition, f4_t param, f4_t *w) {
+  stackmark_t mark = mark_stack();
+
+  f4_t *xx = allocate_f4((size_t) n*m);
+  for (u4_t i = 0; i < n; i++) { // transpose and demean
+    f4_t q = 0.0f;
+    for (u4_t k = 0; k < m; k++) {
+      xx[i*m+k] = x[(size_t) k*n+i];
+      q += xx[i*m+k];
+    }
+    q /= (f4_t) m;
+    for (u4_t k = 0; k < m; k++) {
+      xx[i*m+k] -= q;
+    }
+  }
+  clalign_stack();
+
+  int r = MASSIVE_OK;
+  if (definition == MASSIVE_CORR) {
+    cov(xx, w, n, m);
+  } else if (ridgecov(xx, w, param, n, m) != 0) {
+    r = MASSIVE_ESINGULAR;
+  }
+  if (r == MASSIVE_OK) {
+    cov2corr(w, n);
+  }
+
+  release_stack(mark);
+  return r;
+}
+
+static void thresholds(f4_t const *w, u4_t n,
+  f4_t *t, u4_t k) {
+  stackmark_t mark = mark_stack();
+
+  f4_t *ww = allocate_f4((size_t) n*n);
+  memcpy(ww, w, (size_t) n*n * sizeof(f4_t));
+
+  proportional2absolutethreshold(ww, t, n, k);
+
+  release_stack(mark);
+}
+
+static void measures(f4_t const *w, u4_t n,
+  f4_t threshold, f4_t *charpath, f4_t *efficiency, f4_t *clustering,
+  f4_t *localclustering) {
+  stackmark_t mark = mark_stack();
+
+  size_t const nn = (size_t) n*n;
+
+  f4_t *ww = allocate_f4(nn);
+  clalign_stack();
+
+  if (charpath || efficiency) {
+    memcpy(ww, w, nn * sizeof(f4_t));
+    applyabsolutethreshold(ww, threshold, n);
+    pathlength(ww, efficiency, NULL, charpath, n);
+  }
+
+  if (clustering || localclustering) {
+    memcpy(ww, w, nn * sizeof(f4_t));
+    applyabsolutethreshold(ww, threshold, n);
+    if (localclustering) {
+      memset(localclustering, 0, n * sizeof(f4_t));
+    }
+    triangles(ww, clustering, localclustering, n);
+  }
+
+  release_stack(mark);
+}
+
+int massive_network(massive_t *c, float const *x, unsigned n, unsigned m,
+  int definition, float param, float *w) {
+  if (!x || !w || n < 2 || m < 2 || (definition != MASSIVE_CORR && definition != MASSIVE_RIDGE)) {
+    return MASSIVE_EINVAL;
+  }
+
+  saved_t v;
+  int r = enter(c, networksize(n, m), &v);
+  if (r != MASSIVE_OK) {
+    return r;
+  }
+
+  r = network(x, n, m, definition, param, w);
+
+  leave(&v);
+  return r;
+}
+
+int massive_thresholds(massive_t *c, float const *w, unsigned n,
+  float const *proportions, float *t, unsigned k) {
+  if (!w || !proportions || !t || n < 2) {
+    return MASSIVE_EINVAL;
+  }
+
+  saved_t v;
+  int r = enter(c, thresholdssize(n), &v);
+  if (r != MASSIVE_OK) {
+    return r;
+  }
+
+  memcpy(t, proportions, k * sizeof(f4_t));
+  thresholds(w, n, t, k);
+
+  leave(&v);
+  return r;
+}
+
+int massive_measures(massive_t *c, float const *w, unsigned n,
+  float threshold, float *charpath, float *efficiency, float *clustering,
+  float *localclustering) {
+  if (!w || n < 2) {
+    return MASSIVE_EINVAL;
+  }
+
+  saved_t v;
+  int r = enter(c, measuressize(n), &v);
+  if (r != MASSIVE_OK) {
+    return r;
+  }
+
+  measures(w, n, threshold, charpath, efficiency, clustering, localclustering);
+
+  leave(&v);
+  return r;
+}
+
+/* in a batch the subjects are spread over the threads of the context, and
+   every thread gets an equal slice of the workspace. the kernels of one
+   subject then run on a single thread
+*/
+
+static size_t slicesize(u4_t n, u4_t m, u4_t nt) {
+  return massive_workspace(n, m) + (size_t) (n*n + nt) * sizeof(f4_t) + 2*clb;
+}
+
+static u4_t batchthreads(massive_t *c) {
+  return (c && c->threads > 0) ? (u4_t) c->threads : (u4_t) omp_get_max_threads();
+}
+
+size_t massive_batchworkspace(unsigned n, unsigned m, unsigned nthresholds,
+  int threads) {
+  u4_t const nth = threads > 0 ? (u4_t) threads : (u4_t) omp_get_max_threads();
+  return nth * slicesize(n, m, nthresholds);
+}
+
+static int subject(float const *x, u4_t n, u4_t m,
+  int const *definitions, float const *params, u4_t nd,
+  int const *types, float const *tparams, u4_t nt,
+  f4_t *o) {
+
+  f4_t *w = allocate_f4((size_t) n*n);
+  clalign_stack();
+  f4_t *t = allocate_f4(nt);
+
+  size_t const nc = (size_t) nd*nt;
+
+  for (u4_t i = 0; i < nd; i++) {
+    int r = network(x, n, m, definitions[i], params[i], w);
+    if (r != MASSIVE_OK) {
+      return r;
+    }
+
+    u4_t k = 0;
+    for (u4_t jj = 0; jj < nt; jj++) {
+      if (types[jj] != MASSIVE_ABSOLUTE) {
+        t[k++] = tparams[jj];
+      }
+    }
+    thresholds(w, n, t, k);
+
+    k = 0;
+    for (u4_t jj = 0; jj < nt; jj++) {
+      f4_t th = tparams[jj];
+      if (types[jj] != MASSIVE_ABSOLUTE) {
+        th = t[k++];
+        if (types[jj] == MASSIVE_NNEGPROPORTIONAL && th < 0.0f) {
+          th = 0.0f;
+        }
+      }
+
+      size_t const oi = (size_t) i*nt+jj;
+      measures(w, n, th, &o[oi], &o[nc+oi], &o[2*nc+oi], NULL);
+    }
+  }
+
+  return MASSIVE_OK;
+}
+
+int massive_batch(massive_t *c, float const *x,
+  unsigned nsubjects, unsigned n, unsigned m,
+  int const *definitions, float const *params, unsigned ndefinitions,
+  int const *types, float const *thresholdparams, unsigned nthresholds,
+  float *out) {
+  if (!c || !c->workspace || !x || !out || n < 2 || m < 2 || \
+    !definitions || !params || !types || !thresholdparams) {
+    return MASSIVE_EINVAL;
+  }
+  for (u4_t i = 0; i < ndefinitions; i++) {
+    if (definitions[i] != MASSIVE_CORR && definitions[i] != MASSIVE_RIDGE) {
+      return MASSIVE_EINVAL;
+    }
+  }
+  for (u4_t i = 0; i < nthresholds; i++) {
+    if (types[i] != MASSIVE_ABSOLUTE && types[i] != MASSIVE_PROPORTIONAL && \
+      types[i] != MASSIVE_NNEGPROPORTIONAL) {
+      return MASSIVE_EINVAL;
+    }
+  }
+
+  u4_t const nth = batchthreads(c);
+  size_t const s = slicesize(n, m, nthresholds);
+  if (c->size < nth * s) {
+    return MASSIVE_ENOMEM;
+  }
+
+  size_t const so = (size_t) 3*ndefinitions*nthresholds;
+
+  int r = MASSIVE_OK;
+
+  #pragma omp parallel num_threads(nth)
+  {
+    stackmark_t b = mark_stack();
+    u4_t const k = omp_get_thread_num();
+
+    attach_stack(c->workspace + k*s, s);
+    clalign_stack();
+    stackmark_t mark = mark_stack();
+
+    #pragma omp for schedule(dynamic)
+    for (u4_t i = 0; i < nsubjects; i++) {
+      int rr = subject(&x[(size_t) i*m*n], n, m, definitions, params, ndefinitions,
+        types, thresholdparams, nthresholds, &out[i*so]);
+      release_stack(mark);
+      if (rr != MASSIVE_OK) {
+        #pragma omp atomic write
+        r = rr;
+      }
+    }
+
+    release_stack(b);
+  }
+
+  return r;
+}
+
+char const *massive_strerror(int e) {
+  switch (e) {
+    case MASSIVE_OK:
+      return "success";
+    case MASSIVE_EINVAL:
+      return "invalid argument";
+    case MASSIVE_ENOMEM:
+      return "workspace too small";
+    case MASSIVE_ESINGULAR:
+      return "ridge regression failed";
+    default:
+      return "unknown error";
+  }
+}
@@ -0,0 +1,105 @@
+// This library is part of Massive, copyright 2017 Lea Waller.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __MASSIVE_H__
+#define __MASSIVE_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* libmassive computes the networks and measures of m_brainconnectivity
+   in-process. memory comes from the workspace of the caller, and all
+   state from the context, so threads can make calls at the same time as
+   long as each uses its own context. the functions return MASSIVE_OK or
+   one of the negative error codes. a call whose workspace is smaller than
+   its size returns MASSIVE_ENOMEM. the sizes cover what the kernels
+   allocate; a kernel that needs more takes it from the heap until the
+   call returns, and exits the process if the heap is exhausted too
+*/
+
+enum {
+  MASSIVE_OK = 0,
+  MASSIVE_EINVAL = -1, // invalid argument
+  MASSIVE_ENOMEM = -2, // workspace too small, see massive_workspace
+  MASSIVE_ESINGULAR = -3 // ridge regression failed
+};
+
+enum {
+  MASSIVE_CORR = 0, // pearson correlation
+  MASSIVE_RIDGE = 1 // ridge-regularized partial correlation
+};
+
+enum {
+  MASSIVE_ABSOLUTE = 0, // all weights above the value are retained
+  MASSIVE_PROPORTIONAL = 1, // a proportion of the strongest weights
+  MASSIVE_NNEGPROPORTIONAL = 2 // also removes negative weights
+};
+
+typedef struct {
+  unsigned char *workspace;
+  size_t size;
+  int threads; // OpenMP threads per call, or 0 for the default
+} massive_t;
+
+// bytes of workspace needed for n nodes and m time points
+size_t massive_workspace(unsigned n, unsigned m);
+
+int massive_init(massive_t *c, void *workspace, size_t size, int threads);
+
+/* x has m rows of time points and n columns of nodes. w receives the n*n
+   matrix of weights, scaled as correlations, with a zero diagonal
+*/
+int massive_network(massive_t *c, float const *x, unsigned n, unsigned m,
+  int definition, float param, float *w);
+
+/* converts k proportions of the strongest weights of w to absolute
+   thresholds t
+*/
+int massive_thresholds(massive_t *c, float const *w, unsigned n,
+  float const *proportions, float *t, unsigned k);
+
+/* measures of w after removing all weights below threshold. pass NULL for
+   the measures that are not needed. localclustering has n elements
+*/
+int massive_measures(massive_t *c, float const *w, unsigned n,
+  float threshold, float *charpath, float *efficiency, float *clustering,
+  float *localclustering);
+
+/* runs every network definition and threshold for nsubjects time series
+   of m time points by n nodes, stored one after the other in x. out
+   receives charpath, efficiency and clustering_coef for every subject,
+   as subject x measure x definition x threshold. the subjects are run in
+   parallel on the threads of the context, which need a workspace of
+   massive_batchworkspace bytes together
+*/
+size_t massive_batchworkspace(unsigned n, unsigned m, unsigned nthresholds,
+  int threads);
+
+int massive_batch(massive_t *c, float const *x,
+  unsigned nsubjects, unsigned n, unsigned m,
+  int const *definitions, float const *params, unsigned ndefinitions,
+  int const *types, float const *thresholdparams, unsigned nthresholds,
+  float *out);
+
+char const *massive_strerror(int e);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,181 @@
+# This library is part of Massive, copyright 2017 Lea Waller.
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU Lesser General Public License as published by the
+# Free Software Foundation, either version 3 of the License, or (at your
+# option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+# for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""numpy bindings for libmassive, see massive.h
+
+Arrays are passed to the library as pointers, so float32 arrays in C order
+are not copied, and results are written into arrays allocated here. ctypes
+releases the GIL for the duration of every call, and the computations run
+on the OpenMP threads of the library.
+
+    import massive
+    w = massive.network(x, "ridge", 1.0) # x is time points by nodes
+    t = massive.thresholds(w, [0.1, 0.2])
+    m = massive.measures(w, t[0])
+    o = massive.batch(xs, ["corr", "ridge:2"], ["proportional:0.1"])
+"""
+
+import ctypes
+import os
+import threading
+
+import numpy as np
+
+_path = os.environ.get("MASSIVE_LIBRARY",
+    os.path.join(os.path.dirname(os.path.abspath(__file__)), "libmassive.so"))
+_lib = ctypes.CDLL(_path)
+
+_f4p = ctypes.POINTER(ctypes.c_float)
+_i4p = ctypes.POINTER(ctypes.c_int)
+
+_lib.massive_workspace.restype = ctypes.c_size_t
+_lib.massive_workspace.argtypes = [ctypes.c_uint, ctypes.c_uint]
+_lib.massive_batchworkspace.restype = ctypes.c_size_t
+_lib.massive_batchworkspace.argtypes = [ctypes.c_uint, ctypes.c_uint,
+    ctypes.c_uint, ctypes.c_int]
+_lib.massive_strerror.restype = ctypes.c_char_p
+_lib.massive_strerror.argtypes = [ctypes.c_int]
+
+
+class _context(ctypes.Structure):
+    _fields_ = [("workspace", ctypes.c_void_p), ("size", ctypes.c_size_t),
+        ("threads", ctypes.c_int)]
+
+
+_lib.massive_network.argtypes = [ctypes.POINTER(_context), _f4p,
+    ctypes.c_uint, ctypes.c_uint, ctypes.c_int, ctypes.c_float, _f4p]
+_lib.massive_thresholds.argtypes = [ctypes.POINTER(_context), _f4p,
+    ctypes.c_uint, _f4p, _f4p, ctypes.c_uint]
+_lib.massive_measures.argtypes = [ctypes.POINTER(_context), _f4p,
+    ctypes.c_uint, ctypes.c_float, _f4p, _f4p, _f4p, _f4p]
+_lib.massive_batch.argtypes = [ctypes.POINTER(_context), _f4p,
+    ctypes.c_uint, ctypes.c_uint, ctypes.c_uint,
+    _i4p, _f4p, ctypes.c_uint, _i4p, _f4p, ctypes.c_uint, _f4p]
+
+CORR, RIDGE = 0, 1
+ABSOLUTE, PROPORTIONAL, NNEGPROPORTIONAL = 0, 1, 2
+
+_definitions = {"corr": CORR, "ridge": RIDGE}
+_thresholds = {"absolute": ABSOLUTE, "proportional": PROPORTIONAL,
+    "nnegproportional": NNEGPROPORTIONAL}
+
+measures_str = ["global:charpath", "global:efficiency",
+    "global:clustering_coef"]
+
+
+class MassiveError(RuntimeError):
+    pass
+
+
+# every Python thread keeps its own workspace, so calls from several threads
+# do not share a context
+_local = threading.local()
+
+
+def _workspace(size):
+    b = getattr(_local, "workspace", None)
+    if b is None or b.size < size:
+        b = np.empty(size, dtype=np.uint8)
+        _local.workspace = b
+    return b
+
+
+def _context_for(size, threads):
+    b = _workspace(size)
+    return _context(b.ctypes.data, b.size, threads), b
+
+
+def _check(r):
+    if r != 0:
+        raise MassiveError(_lib.massive_strerror(r).decode())
+
+
+def _f4(a):
+    return np.ascontiguousarray(a, dtype=np.float32) # no copy if possible
+
+
+def _ptr(a):
+    return a.ctypes.data_as(_f4p)
+
+
+def _parse(s, table, default):
+    tok = s.split(":")
+    if tok[0] not in table:
+        raise ValueError("undefined %s" % s)
+    return table[tok[0]], float(tok[1]) if len(tok) > 1 else default
+
+
+def network(x, definition="corr", param=1.0, threads=0):
+    """weights of the nodes in the columns of x, scaled as correlations"""
+    x = _f4(x)
+    m, n = x.shape
+    if isinstance(definition, str):
+        definition, param = _parse(definition, _definitions, param)
+    w = np.empty((n, n), dtype=np.float32)
+    c, b = _context_for(_lib.massive_workspace(n, m), threads)
+    _check(_lib.massive_network(ctypes.byref(c), _ptr(x), n, m,
+        definition, param, _ptr(w)))
+    return w
+
+
+def thresholds(w, proportions, threads=0):
+    """absolute thresholds that retain proportions of the strongest weights"""
+    w = _f4(w)
+    n = w.shape[0]
+    p = _f4(np.atleast_1d(proportions))
+    t = np.empty(p.shape, dtype=np.float32)
+    c, b = _context_for(_lib.massive_workspace(n, 2), threads)
+    _check(_lib.massive_thresholds(ctypes.byref(c), _ptr(w), n, _ptr(p),
+        _ptr(t), p.size))
+    return t
+
+
+def measures(w, threshold, local=False, threads=0):
+    """charpath, efficiency and clustering_coef after thresholding"""
+    w = _f4(w)
+    n = w.shape[0]
+    o = np.empty(3, dtype=np.float32)
+    cl = np.empty(n, dtype=np.float32) if local else None
+    c, b = _context_for(_lib.massive_workspace(n, 2), threads)
+    _check(_lib.massive_measures(ctypes.byref(c), _ptr(w), n, threshold,
+        _ptr(o[0:]), _ptr(o[1:]), _ptr(o[2:]),
+        _ptr(cl) if local else None))
+    r = dict(zip(measures_str, o.tolist()))
+    if local:
+        r["local:clustering_coef"] = cl
+    return r
+
+
+def batch(x, definitions=("corr",), thresholds=("absolute:-1.0",),
+        threads=0):
+    """measures of subjects x time points x nodes, as subject x measure x
+    definition x threshold. the subjects run in parallel"""
+    x = _f4(x)
+    s, m, n = x.shape
+
+    d = [_parse(k, _definitions, 1.0) for k in definitions]
+    t = [_parse(k, _thresholds, 0.0) for k in thresholds]
+    di = np.array([k for k, _ in d], dtype=np.int32)
+    dp = np.array([p for _, p in d], dtype=np.float32)
+    ti = np.array([k for k, _ in t], dtype=np.int32)
+    tp = np.array([p for _, p in t], dtype=np.float32)
+
+    o = np.empty((s, 3, len(d), len(t)), dtype=np.float32)
+    c, b = _context_for(_lib.massive_batchworkspace(n, m, len(t), threads),
+        threads)
+    _check(_lib.massive_batch(ctypes.byref(c), _ptr(x), s, n, m,
+        di.ctypes.data_as(_i4p), _ptr(dp), len(d),
+        ti.ctypes.data_as(_i4p), _ptr(tp), len(t), _ptr(o)))
+    return o